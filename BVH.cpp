@@ -0,0 +1,185 @@
+// BVH.cpp : Binned SAH construction of the bounding volume hierarchy declared in BVH.h
+//
+
+#include <chrono>
+#include "BVH.h"
+
+namespace
+{
+    constexpr int sah_bins = 16;
+    constexpr int max_build_depth = 60;     // traversal stack is 64 deep
+    constexpr float traversal_cost = 1.0f;  // relative to one primitive intersection
+}
+
+void BVH::build(const std::vector<AABB>& prim_bounds, int max_leaf)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    nodes.clear();
+    prim_indices.clear();
+    max_depth = 0;
+    leaf_count = 0;
+
+    if (!prim_bounds.empty())
+    {
+        std::vector<BuildPrim> prims(prim_bounds.size());
+        for (size_t i = 0; i < prim_bounds.size(); ++i)
+            prims[i] = BuildPrim{ prim_bounds[i], prim_bounds[i].centroid(), uint32_t(i) };
+
+        // A binary tree over n leaves never needs more than 2n - 1 nodes
+        nodes.reserve(2 * prims.size());
+        build_recursive(prims, 0, uint32_t(prims.size()), 0, std::max(1, max_leaf));
+
+        prim_indices.resize(prims.size());
+        for (size_t i = 0; i < prims.size(); ++i)
+            prim_indices[i] = prims[i].index;
+        nodes.shrink_to_fit();
+    }
+
+    build_cost = sah_cost();
+    build_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void BVH::refit(const std::vector<AABB>& prim_bounds)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Children always come after their parent in the array, so one backwards pass sees them first
+    for (size_t n = nodes.size(); n-- > 0;)
+    {
+        BVHNode& node = nodes[n];
+        AABB bounds;
+        if (node.is_leaf())
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                bounds.expand(prim_bounds[prim_indices[i]]);
+        }
+        else
+        {
+            bounds = nodes[n + 1].bounds();
+            bounds.expand(nodes[node.offset].bounds());
+        }
+        node.set_bounds(bounds);
+    }
+
+    refit_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+float BVH::sah_cost() const
+{
+    if (nodes.empty()) return 0.f;
+    float root_area = nodes[0].bounds().half_area();
+    if (root_area <= 0.f) return 0.f;
+
+    double cost = 0;
+    for (const BVHNode& node : nodes)
+        cost += node.bounds().half_area() * (node.is_leaf() ? float(node.count) : traversal_cost);
+    return float(cost / root_area);
+}
+
+uint32_t BVH::build_recursive(std::vector<BuildPrim>& prims, uint32_t begin, uint32_t end, int depth, int max_leaf)
+{
+    uint32_t node_index = uint32_t(nodes.size());
+    nodes.push_back(BVHNode{});
+    max_depth = std::max(max_depth, depth);
+
+    AABB bounds, centroid_bounds;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        bounds.expand(prims[i].bounds);
+        centroid_bounds.expand(prims[i].centroid);
+    }
+    nodes[node_index].set_bounds(bounds);
+
+    uint32_t count = end - begin;
+    auto make_leaf = [&]() {
+        nodes[node_index].offset = begin;
+        nodes[node_index].count = uint16_t(count);
+        ++leaf_count;
+        return node_index;
+    };
+
+    if (count <= 1 || depth >= max_build_depth)
+        return make_leaf();
+
+    // Split along the axis with the widest centroid spread
+    Vec3f extent = centroid_bounds.hi - centroid_bounds.lo;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    float axis_lo = centroid_bounds.lo[axis], axis_extent = extent[axis];
+
+    // All centroids on top of each other, no split can separate them
+    if (axis_extent <= 0.f)
+        return count <= uint32_t(max_leaf) ? make_leaf() : split_median(prims, begin, end, axis, depth, max_leaf, node_index);
+
+    // Bin the centroids and sweep the bins from both sides to evaluate every split plane
+    struct Bin { AABB bounds; uint32_t count{}; };
+    Bin bins[sah_bins];
+    float bin_scale = sah_bins / axis_extent;
+    auto bin_of = [&](const BuildPrim& p) {
+        return std::min(sah_bins - 1, int((p.centroid[axis] - axis_lo) * bin_scale));
+    };
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        Bin& b = bins[bin_of(prims[i])];
+        b.bounds.expand(prims[i].bounds);
+        ++b.count;
+    }
+
+    float right_area[sah_bins - 1];
+    uint32_t right_count[sah_bins - 1];
+    AABB acc;
+    uint32_t acc_count = 0;
+    for (int i = sah_bins - 1; i > 0; --i)
+    {
+        acc.expand(bins[i].bounds);
+        acc_count += bins[i].count;
+        right_area[i - 1] = acc.half_area();
+        right_count[i - 1] = acc_count;
+    }
+
+    float best_cost = std::numeric_limits<float>::max();
+    int best_split = -1;
+    acc = AABB{};
+    acc_count = 0;
+    for (int i = 0; i < sah_bins - 1; ++i)
+    {
+        acc.expand(bins[i].bounds);
+        acc_count += bins[i].count;
+        if (acc_count == 0 || right_count[i] == 0) continue;
+        float cost = acc.half_area() * acc_count + right_area[i] * right_count[i];
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best_split = i;
+        }
+    }
+
+    float leaf_cost = bounds.half_area() * count;
+    best_cost = traversal_cost * bounds.half_area() + best_cost;
+    if (best_split < 0 || (count <= uint32_t(max_leaf) && best_cost >= leaf_cost))
+        return count <= uint32_t(max_leaf) ? make_leaf() : split_median(prims, begin, end, axis, depth, max_leaf, node_index);
+
+    BuildPrim* mid_ptr = std::partition(prims.data() + begin, prims.data() + end,
+        [&](const BuildPrim& p) { return bin_of(p) <= best_split; });
+    uint32_t mid = uint32_t(mid_ptr - prims.data());
+
+    build_recursive(prims, begin, mid, depth + 1, max_leaf);
+    uint32_t right = build_recursive(prims, mid, end, depth + 1, max_leaf);
+    nodes[node_index].offset = right;
+    nodes[node_index].axis = uint16_t(axis);
+    return node_index;
+}
+
+// Fallback when SAH can't separate the primitives (e.g. identical centroids): split the range in half
+uint32_t BVH::split_median(std::vector<BuildPrim>& prims, uint32_t begin, uint32_t end, int axis, int depth, int max_leaf, uint32_t node_index)
+{
+    uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(prims.data() + begin, prims.data() + mid, prims.data() + end,
+        [axis](const BuildPrim& a, const BuildPrim& b) { return a.centroid[axis] < b.centroid[axis]; });
+
+    build_recursive(prims, begin, mid, depth + 1, max_leaf);
+    uint32_t right = build_recursive(prims, mid, end, depth + 1, max_leaf);
+    nodes[node_index].offset = right;
+    nodes[node_index].axis = uint16_t(axis);
+    return node_index;
+}
@@ -0,0 +1,191 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include "Geometry.h"
+
+// Axis aligned bounding box, used as the bounding volume of every BVH node
+struct AABB
+{
+	Vec3f lo{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	Vec3f hi{ -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+
+	AABB() = default;
+	AABB(const Vec3f& l, const Vec3f& h) : lo{ l }, hi{ h } {}
+
+	void expand(const Vec3f& p)
+	{
+		lo = Vec3f(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+		hi = Vec3f(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+	}
+
+	void expand(const AABB& b) { expand(b.lo); expand(b.hi); }
+
+	Vec3f centroid() const { return (lo + hi) * 0.5f; }
+
+	// Half of the surface area is enough for SAH, only the ratios matter
+	float half_area() const
+	{
+		if (lo.x > hi.x) return 0.f;
+		Vec3f e = hi - lo;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	// Slab test. inv_dir is 1/dir per component, t_max the closest hit found so far
+	bool ray_intersect(const Vec3f& orig, const Vec3f& inv_dir, float t_max) const
+	{
+		float tx1 = (lo.x - orig.x) * inv_dir.x, tx2 = (hi.x - orig.x) * inv_dir.x;
+		float t_near = std::min(tx1, tx2), t_far = std::max(tx1, tx2);
+		float ty1 = (lo.y - orig.y) * inv_dir.y, ty2 = (hi.y - orig.y) * inv_dir.y;
+		t_near = std::max(t_near, std::min(ty1, ty2)); t_far = std::min(t_far, std::max(ty1, ty2));
+		float tz1 = (lo.z - orig.z) * inv_dir.z, tz2 = (hi.z - orig.z) * inv_dir.z;
+		t_near = std::max(t_near, std::min(tz1, tz2)); t_far = std::min(t_far, std::max(tz1, tz2));
+		return t_far >= std::max(t_near, 0.f) && t_near < t_max;
+	}
+};
+
+// Flattened node, 32 bytes so two of them share a cache line. The box is kept as plain floats, an AABB of
+// padded Vec3f would make it 48.
+// Interior : left child is the next node in the array, 'offset' is the right child.
+// Leaf     : 'offset' is the first entry of prim_indices, 'count' the number of primitives.
+struct BVHNode
+{
+	float lo[3]{};
+	uint32_t offset{};
+	float hi[3]{};
+	uint16_t count{};
+	uint16_t axis{};
+
+	bool is_leaf() const { return count > 0; }
+
+	AABB bounds() const { return AABB(Vec3f(lo[0], lo[1], lo[2]), Vec3f(hi[0], hi[1], hi[2])); }
+	void set_bounds(const AABB& b)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			lo[a] = b.lo[a];
+			hi[a] = b.hi[a];
+		}
+	}
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode should stay half a cache line");
+
+class BVH
+{
+public:
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> prim_indices;	// leaf ranges index into this, it maps back to the caller's primitives
+
+	// Statistics of the last build, see report
+	double build_ms{};
+	int max_depth{};
+	int leaf_count{};
+	float build_cost{};		// sah_cost() right after the build
+	double refit_ms{};		// of the last refit
+
+	// Builds over the bounds of any primitive list. Binned SAH, 'max_leaf' primitives per leaf at most
+	void build(const std::vector<AABB>& prim_bounds, int max_leaf = 4);
+
+	// Recomputes every node's bounds bottom up for primitives that moved, keeping the tree. Much cheaper than
+	// a build, but the tree gets worse the further things move from where it was built, see sah_cost
+	void refit(const std::vector<AABB>& prim_bounds);
+
+	// Expected cost of a ray through the tree relative to testing one primitive, as the build estimates it.
+	// A refit tree whose cost has grown well past build_cost is worth rebuilding
+	float sah_cost() const;
+
+	bool empty() const { return nodes.empty(); }
+
+	// Closest hit traversal. 'leaf' is called as leaf(first, count, t_max) for every leaf the ray reaches,
+	// it tests prim_indices[first .. first+count) and shrinks t_max when it finds something closer.
+	template<typename LeafFn>
+	void traverse(const Vec3f& orig, const Vec3f& dir, float& t_max, LeafFn&& leaf) const
+	{
+		if (nodes.empty()) return;
+		Vec3f inv_dir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+		int dir_neg[3] = { dir.x < 0, dir.y < 0, dir.z < 0 };
+
+		uint32_t stack[64];
+		int sp = 0;
+		uint32_t current = 0;
+		while (true)
+		{
+			const BVHNode& node = nodes[current];
+			if (node.bounds().ray_intersect(orig, inv_dir, t_max))
+			{
+				if (node.is_leaf())
+				{
+					leaf(node.offset, node.count, t_max);
+				}
+				else
+				{
+					// Visit the near child first so t_max shrinks early
+					if (dir_neg[node.axis])
+					{
+						stack[sp++] = current + 1;
+						current = node.offset;
+					}
+					else
+					{
+						stack[sp++] = node.offset;
+						current = current + 1;
+					}
+					continue;
+				}
+			}
+			if (sp == 0) break;
+			current = stack[--sp];
+		}
+	}
+
+	// Any hit traversal for occlusion. 'leaf' is called as leaf(first, count) and returns true when one of
+	// its primitives blocks the ray before t_max, which ends the traversal
+	template<typename LeafFn>
+	bool traverse_any(const Vec3f& orig, const Vec3f& dir, float t_max, LeafFn&& leaf) const
+	{
+		if (nodes.empty()) return false;
+		Vec3f inv_dir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+
+		uint32_t stack[64];
+		int sp = 0;
+		uint32_t current = 0;
+		while (true)
+		{
+			const BVHNode& node = nodes[current];
+			if (node.bounds().ray_intersect(orig, inv_dir, t_max))
+			{
+				if (node.is_leaf())
+				{
+					if (leaf(node.offset, node.count))
+						return true;
+				}
+				else
+				{
+					// No ordering needed, any blocker will do
+					stack[sp++] = node.offset;
+					current = current + 1;
+					continue;
+				}
+			}
+			if (sp == 0) break;
+			current = stack[--sp];
+		}
+		return false;
+	}
+
+private:
+	struct BuildPrim
+	{
+		AABB bounds;
+		Vec3f centroid;
+		uint32_t index;
+	};
+
+	uint32_t build_recursive(std::vector<BuildPrim>& prims, uint32_t begin, uint32_t end, int depth, int max_leaf);
+	uint32_t split_median(std::vector<BuildPrim>& prims, uint32_t begin, uint32_t end, int axis, int depth, int max_leaf, uint32_t node_index);
+};
+
+#endif
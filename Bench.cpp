@@ -0,0 +1,329 @@
+// Bench.cpp : The --bench suite declared in Bench.h
+//
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include "RayTracer.h"
+#include "RenderSettings.h"
+#include "Bench.h"
+
+namespace
+{
+    volatile float sink;	// results are folded in here so the compiler can't drop the work
+
+    constexpr double min_run_ms = 20;
+
+    struct Stats
+    {
+        double median{}, min{}, mean{}, stddev{};
+    };
+
+    struct Result
+    {
+        std::string kernel;
+        int spheres = -1, lights = -1, depth = -1, width = -1, height = -1, spp = -1;
+        size_t rays{};		// per repetition
+        Stats ns;			// per ray
+
+        explicit Result(std::string kernel) : kernel(std::move(kernel)) {}
+    };
+
+    // Times 'pass' (which returns the rays it traced) after a warm up that also sizes the repetitions
+    template <class F>
+    Stats measure(int reps, size_t& rays_per_rep, F&& pass)
+    {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        size_t rays = pass();
+        double warm_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        size_t passes = std::max<size_t>(1, size_t(std::ceil(min_run_ms / std::max(warm_ms, 1e-3))));
+
+        std::vector<double> ns(reps);
+        for (int r = 0; r < reps; ++r)
+        {
+            start = clock::now();
+            rays = 0;
+            for (size_t p = 0; p < passes; ++p)
+                rays += pass();
+            ns[r] = std::chrono::duration<double, std::nano>(clock::now() - start).count() / std::max<size_t>(rays, 1);
+        }
+        rays_per_rep = rays;
+
+        Stats s;
+        std::sort(ns.begin(), ns.end());
+        s.median = reps % 2 ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2;
+        s.min = ns.front();
+        for (double v : ns) s.mean += v / reps;
+        for (double v : ns) s.stddev += (v - s.mean) * (v - s.mean) / reps;
+        s.stddev = std::sqrt(s.stddev);
+        return s;
+    }
+
+    Vec3f random_dir(std::mt19937& rng)
+    {
+        std::normal_distribution<float> n;
+        Vec3f d(n(rng), n(rng), n(rng));
+        return d.norm() > 1e-6f ? d.normalize() : Vec3f(0.f, 0.f, -1.f);
+    }
+
+    // The demo scene with its spheres replaced by 'spheres' random ones (unless it is 4) in the same space
+    // in front of the camera, and as many lights: the demo ones first, then random ones above the scene.
+    // Always a fresh scene, demo_scene appends to the one it is given
+    Scene bench_scene(int spheres, int lights, uint32_t seed)
+    {
+        Scene scene;
+        demo_scene(scene);
+        std::mt19937 rng(seed);
+
+        if (spheres != int(scene.spheres.size()))
+        {
+            // Roughly the demo's total sphere volume whatever the count
+            float r = 3.f * std::cbrt(4.f / spheres);
+            std::uniform_real_distribution<float> x(-12.f, 12.f), y(-4.f, 8.f), z(-40.f, -10.f), size(0.5f, 1.5f);
+            std::uniform_int_distribution<uint32_t> material(0, uint32_t(scene.materials.size() - 1));
+            scene.spheres.clear();
+            for (int i = 0; i < spheres; ++i)
+                scene.spheres.push_back(std::make_unique<Sphere>(Vec3f(x(rng), y(rng), z(rng)), r * size(rng), material(rng)));
+        }
+
+        scene.lights.resize(std::min<size_t>(scene.lights.size(), lights));
+        std::uniform_real_distribution<float> lx(-40.f, 40.f), ly(10.f, 60.f), lz(-40.f, 40.f), power(0.5f, 2.f);
+        while (int(scene.lights.size()) < lights)
+            scene.lights.push_back(std::make_unique<Light>(Vec3f(lx(rng), ly(rng), lz(rng)), power(rng) * 3.f / lights));
+
+        scene.build_bvh();
+        return scene;
+    }
+
+    // Primary ray directions on a grid over the frame, about 'count' of them
+    std::vector<Vec3f> primary_dirs(const Camera& camera, size_t count)
+    {
+        int step = std::max(1, int(std::sqrt(double(camera.width()) * camera.height() / count)));
+        std::vector<Vec3f> dirs;
+        for (int j = 0; j < camera.height(); j += step)
+            for (int i = 0; i < camera.width(); i += step)
+                dirs.push_back(camera.dir(i, j));
+        return dirs;
+    }
+
+    std::string params(const Result& r)
+    {
+        std::ostringstream s;
+        if (r.spheres >= 0) s << " spheres=" << r.spheres;
+        if (r.lights >= 0) s << " lights=" << r.lights;
+        if (r.depth >= 0) s << " depth=" << r.depth;
+        if (r.width >= 0) s << " " << r.width << "x" << r.height << "x" << r.spp;
+        return s.str();
+    }
+
+    void print(const Result& r)
+    {
+        std::cout << std::left << std::setw(18) << r.kernel << std::setw(36) << params(r) << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << r.ns.median << " ns/ray" << std::setw(10) << 1e3 / r.ns.median << " Mrays/s  +-"
+            << std::setprecision(1) << 100 * r.ns.stddev / r.ns.mean << "%" << std::defaultfloat << std::endl;
+    }
+
+    bool write_json(const char* filename, const RenderSettings& settings, ThreadPool& pool, const std::vector<Result>& results)
+    {
+        std::ofstream out(filename);
+        out << "{\n  \"threads\": " << pool.size() << ",\n  \"lane_width\": " << SphereSoA::lane_width
+            << ",\n  \"engine\": \"" << (render_engine == Engine::Wavefront ? "wavefront" : "recursive")
+            << "\",\n  \"vec_backend\": \"" << vec4::backend
+            << "\",\n  \"packets\": " << (use_packets ? "true" : "false")
+            << ",\n  \"termination\": \"" << (ray_termination == Termination::Exact ? "exact" : ray_termination == Termination::Threshold ? "threshold" : "russian_roulette")
+            << "\",\n  \"min_contribution\": " << min_contribution << ",\n  \"max_depth\": " << max_depth << ",\n  \"reps\": " << settings.bench_reps << ",\n  \"results\": [";
+        out << std::setprecision(6);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            out << (i ? "," : "") << "\n    { \"kernel\": \"" << r.kernel << "\"";
+            if (r.spheres >= 0) out << ", \"spheres\": " << r.spheres;
+            if (r.lights >= 0) out << ", \"lights\": " << r.lights;
+            if (r.depth >= 0) out << ", \"depth\": " << r.depth;
+            if (r.width >= 0) out << ", \"width\": " << r.width << ", \"height\": " << r.height << ", \"spp\": " << r.spp;
+            out << ", \"rays\": " << r.rays << ", \"ns_per_ray\": { \"median\": " << r.ns.median << ", \"min\": " << r.ns.min
+                << ", \"mean\": " << r.ns.mean << ", \"stddev\": " << r.ns.stddev << " }, \"mrays_per_s\": " << 1e3 / r.ns.median << " }";
+        }
+        out << "\n  ]\n}\n";
+        out.close();
+        if (!out)
+        {
+            std::cerr << "Error: can not write " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+bool run_benchmarks(const RenderSettings& settings, ThreadPool& pool)
+{
+    std::vector<Result> results;
+    auto add = [&](Result r) {
+        print(r);
+        results.push_back(r);
+    };
+    const int reps = settings.bench_reps;
+    std::mt19937 rng(1);
+
+    // Kernels that don't depend on the scene, over a fixed set of random inputs
+    const size_t n = 1 << 16;
+    std::vector<Vec3f> dirs(n), normals(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        dirs[i] = random_dir(rng);
+        normals[i] = random_dir(rng);
+    }
+
+    {
+        Result r{ "sphere_intersect" };
+        Sphere sphere(Vec3f(0.f, 0.f, -3.f), 1.f, 0);
+        r.ns = measure(reps, r.rays, [&] {
+            float acc = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                float t;
+                if (sphere.ray_intersect(Vec3f(0.f, 0.f, 0.f), dirs[i], t)) acc += t;
+            }
+            sink = sink + acc;
+            return n;
+        });
+        add(r);
+    }
+    {
+        Result r{ "vec_dot" };
+        r.ns = measure(reps, r.rays, [&] {
+            float acc = 0;
+            for (size_t i = 0; i < n; ++i)
+                acc += dirs[i] * normals[i];
+            sink = sink + acc;
+            return n;
+        });
+        add(r);
+    }
+    {
+        Result r{ "vec_normalize" };
+        r.ns = measure(reps, r.rays, [&] {
+            Vec3f acc;
+            for (size_t i = 0; i < n; ++i)
+                acc = acc + (dirs[i] + normals[i]).normalize();
+            sink = sink + acc.x;
+            return n;
+        });
+        add(r);
+    }
+    {
+        // The shape of the shading code: scale, add and subtract of a few vectors
+        Result r{ "vec_arith" };
+        r.ns = measure(reps, r.rays, [&] {
+            Vec3f acc;
+            for (size_t i = 0; i < n; ++i)
+                acc = acc + dirs[i] * 0.5f - normals[i] * 1e-3f + (-dirs[i]);
+            sink = sink + acc.x;
+            return n;
+        });
+        add(r);
+    }
+    {
+        Result r{ "reflect" };
+        r.ns = measure(reps, r.rays, [&] {
+            Vec3f acc;
+            for (size_t i = 0; i < n; ++i)
+                acc = acc + reflect(dirs[i], normals[i]);
+            sink = sink + acc.x;
+            return n;
+        });
+        add(r);
+    }
+    {
+        Result r{ "refract" };
+        r.ns = measure(reps, r.rays, [&] {
+            Vec3f acc;
+            for (size_t i = 0; i < n; ++i)
+                acc = acc + refract(dirs[i], normals[i], 1.5f);
+            sink = sink + acc.x;
+            return n;
+        });
+        add(r);
+    }
+    {
+        Result r{ "background_color" };
+        r.ns = measure(reps, r.rays, [&] {
+            Vec3f acc;
+            for (size_t i = 0; i < n; ++i)
+                acc = acc + background_color(Vec3f(0.f, 0.f, 0.f), dirs[i]);
+            sink = sink + acc.x;
+            return n;
+        });
+        add(r);
+    }
+
+    // Scene queries per sphere count, the light count only matters once shading starts
+    const int default_lights = 3;
+    Camera camera(settings.width, settings.height, settings.fov);
+    std::vector<Vec3f> primary = primary_dirs(camera, n);
+    for (int spheres : settings.bench_spheres)
+    {
+        Scene scene = bench_scene(spheres, default_lights, 7);
+
+        Result r{ "pixel_depth_check" };
+        r.spheres = spheres;
+        r.ns = measure(reps, r.rays, [&] {
+            size_t hits = 0;
+            for (const Vec3f& dir : primary)
+            {
+                uint32_t material = Scene::no_material;
+                Vec3f diffuse, hit_pt, N;
+                hits += pixel_depth_check(camera.origin(), dir, scene, material, diffuse, hit_pt, N);
+            }
+            sink = sink + float(hits);
+            return primary.size();
+        });
+        add(r);
+
+        for (int lights : settings.bench_lights)
+        {
+            if (int(scene.lights.size()) != lights)
+                scene = bench_scene(spheres, lights, 7);
+            for (int depth : { 0, 2, max_depth })
+            {
+                // Starting deeper leaves the ray tree fewer levels, depth 0 is the primary hit alone
+                Result c{ "cast_ray" };
+                c.spheres = spheres;
+                c.lights = lights;
+                c.depth = depth;
+                c.ns = measure(reps, c.rays, [&] {
+                    Vec3f acc;
+                    for (const Vec3f& dir : primary)
+                        acc = acc + cast_ray(camera.origin(), dir, scene, max_depth - depth);
+                    sink = sink + acc.x;
+                    return primary.size();
+                });
+                add(c);
+            }
+
+            Result f{ "render" };
+            f.spheres = spheres;
+            f.lights = lights;
+            f.width = settings.width;
+            f.height = settings.height;
+            f.spp = std::max(settings.spp, 1);	// 0 is a time budget only
+            Framebuffer frame;
+            Camera frame_camera(settings.width, settings.height, settings.fov);
+            f.ns = measure(reps, f.rays, [&] {
+                render_frame(scene, frame_camera, pool, frame, 0, f.spp);
+                return size_t(settings.width) * settings.height * f.spp;
+            });
+            add(f);
+        }
+    }
+
+    return write_json(settings.bench_json.c_str(), settings, pool, results);
+}
@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+struct RenderSettings;
+class ThreadPool;
+
+// Benchmark suite run by --bench, on generated scenes instead of the loaded one:
+//   sphere_intersect    Sphere::ray_intersect, one sphere against random rays
+//   vec_dot / vec_normalize / vec_arith  Vec3f arithmetic on random unit vectors
+//   reflect / refract   the Geometry helpers on random unit vectors
+//   background_color    envmap lookups for random directions
+//   pixel_depth_check   closest hit of the camera's primary rays, per sphere count
+//   cast_ray            full ray trees of the primary rays, per sphere count, light count and depth budget
+//   render              whole frames at the --width x --height / --spp of the settings, per sphere and light count
+// Every benchmark is timed --bench-reps times after a warm up run, each repetition sized to take at least
+// ~20 ms, and is reported as ns per ray (median, min, mean, standard deviation) and Mrays/s of the median.
+// The results go to stdout as a table and to --bench-json as JSON. Needs envmap (the global) loaded and
+// settings.fov resolved.
+bool run_benchmarks(const RenderSettings& settings, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "Geometry.h"
+
+// Pinhole camera at 'eye' looking down -z, fov is the vertical field of view in radians.
+// Sample s of pixel (i, j) goes through (i + dx, j + dy) on the image plane, with the offsets of the Halton
+// sequence in bases 2 and 3. Any run of samples 0 .. n - 1 is stratified over the pixel whatever n is, so a
+// progressive render can stop after any pass. Sample 0 is the offset (0, 0) the single sample renderer always used.
+class Camera
+{
+public:
+	Camera(int width, int height, double fov, const Vec3f& eye = Vec3f(0.f, 0.f, 0.f))
+		: w{ width }, h{ height }, plane_z{ float(-height / (2 * std::tan(fov / 2))) }, position{ eye } {}
+
+	int width() const { return w; }
+	int height() const { return h; }
+	const Vec3f& origin() const { return position; }
+
+	Vec3f dir(size_t i, size_t j, int s = 0) const { return dir(i, j, s, w, h); }
+
+protected:
+	int w, h;
+	float plane_z;	// distance of the image plane, in pixels
+	Vec3f position;
+
+	Vec3f dir(size_t i, size_t j, int s, int width, int height) const
+	{
+		float x = i + offset_x(s) - width / 2.;
+		float y = height / 2. - (j + offset_y(s));
+		return Vec3f(x, y, plane_z).normalize();
+	}
+
+	// Van der Corput radical inverse in base 2
+	static double offset_x(int s)
+	{
+		uint32_t b = uint32_t(s);
+		b = (b << 16) | (b >> 16);
+		b = ((b & 0x00ff00ffu) << 8) | ((b & 0xff00ff00u) >> 8);
+		b = ((b & 0x0f0f0f0fu) << 4) | ((b & 0xf0f0f0f0u) >> 4);
+		b = ((b & 0x33333333u) << 2) | ((b & 0xccccccccu) >> 2);
+		b = ((b & 0x55555555u) << 1) | ((b & 0xaaaaaaaau) >> 1);
+		return b * (1. / 4294967296.);
+	}
+
+	// Radical inverse in base 3
+	static double offset_y(int s)
+	{
+		double r = 0, digit = 1. / 3;
+		for (uint32_t n = uint32_t(s); n; n /= 3, digit /= 3)
+			r += (n % 3) * digit;
+		return r;
+	}
+};
+
+// The same camera with the resolution fixed at compile time. render() picks it when the settings match one of
+// the common sizes, so the image size is folded into the per pixel maths and the tile loops again
+template <int W, int H>
+class FixedCamera : public Camera
+{
+public:
+	explicit FixedCamera(double fov, const Vec3f& eye = Vec3f(0.f, 0.f, 0.f)) : Camera(W, H, fov, eye) {}
+
+	static constexpr int width() { return W; }
+	static constexpr int height() { return H; }
+
+	Vec3f dir(size_t i, size_t j, int s = 0) const { return Camera::dir(i, j, s, W, H); }
+};
+
+#endif
@@ -0,0 +1,92 @@
+// Dependencies.cpp : Per tile dependency records declared in Dependencies.h
+//
+
+#include <algorithm>
+#include "RayTracer.h"
+#include "Dependencies.h"
+
+thread_local TileDependencies::Recorder* TileDependencies::Recorder::current = nullptr;
+
+namespace
+{
+    void sort_unique(std::vector<uint32_t>& v)
+    {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    bool contains(const std::vector<uint32_t>& sorted, uint32_t value)
+    {
+        return std::binary_search(sorted.begin(), sorted.end(), value);
+    }
+}
+
+void TileDependencies::begin_tile(Recorder& recorder) const
+{
+    recorder.spheres.clear();
+    recorder.instances.clear();
+    recorder.shapes.clear();
+    recorder.lights.clear();
+    recorder.shaded = false;
+    Recorder::current = &recorder;
+}
+
+void TileDependencies::end_tile(size_t tile, Recorder& recorder)
+{
+    Recorder::current = nullptr;
+    Tile& t = tiles[tile];
+    t.spheres = recorder.spheres;
+    t.instances = recorder.instances;
+    t.shapes = recorder.shapes;
+    t.lights = recorder.lights;
+    t.shaded = recorder.shaded;
+    sort_unique(t.spheres);
+    sort_unique(t.instances);
+    sort_unique(t.shapes);
+    sort_unique(t.lights);
+}
+
+std::vector<uint32_t> TileDependencies::sphere_changed(uint32_t sphere) const
+{
+    std::vector<uint32_t> out;
+    for (size_t t = 0; t < tiles.size(); ++t)
+        if (contains(tiles[t].spheres, sphere))
+            out.push_back(uint32_t(t));
+    return out;
+}
+
+std::vector<uint32_t> TileDependencies::material_changed(const Scene& scene, uint32_t material) const
+{
+    std::vector<uint32_t> users, instance_users, shape_users;
+    for (size_t i = 0; i < scene.spheres.size(); ++i)
+        if (scene.spheres[i]->material == material)
+            users.push_back(uint32_t(i));
+    for (size_t i = 0; i < scene.instances.size(); ++i)
+        if (scene.instances[i].material == material)
+            instance_users.push_back(uint32_t(i));
+    for (size_t i = 0; i < scene.shapes.size(); ++i)
+        if (scene.shapes[i].material == material)
+            shape_users.push_back(uint32_t(i));
+
+    std::vector<uint32_t> out;
+    for (size_t t = 0; t < tiles.size(); ++t)
+    {
+        const std::vector<uint32_t>& s = tiles[t].spheres;
+        const std::vector<uint32_t>& m = tiles[t].instances;
+        const std::vector<uint32_t>& b = tiles[t].shapes;
+        if (std::any_of(s.begin(), s.end(), [&](uint32_t sphere) { return contains(users, sphere); })
+            || std::any_of(m.begin(), m.end(), [&](uint32_t instance) { return contains(instance_users, instance); })
+            || std::any_of(b.begin(), b.end(), [&](uint32_t shape) { return contains(shape_users, shape); }))
+            out.push_back(uint32_t(t));
+    }
+    return out;
+}
+
+std::vector<uint32_t> TileDependencies::light_changed(uint32_t light, bool moved) const
+{
+    std::vector<uint32_t> out;
+    for (size_t t = 0; t < tiles.size(); ++t)
+        if (moved ? tiles[t].shaded : contains(tiles[t].lights, light))
+            out.push_back(uint32_t(t));
+    return out;
+}
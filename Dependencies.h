@@ -0,0 +1,87 @@
+#ifndef DEPENDENCIES_H
+#define DEPENDENCIES_H
+
+#include <vector>
+#include <cstdint>
+
+struct Scene;
+
+// What the ray trees of a tile depended on, so an edit only needs the tiles it can change rendered again:
+//   spheres   : every sphere a ray of the tile hit and shaded (by index into Scene::spheres)
+//   instances : the same for Scene::instances
+//   shapes    : the same for Scene::shapes
+//   lights    : every light that lit a hit of the tile, not facing away and not in shadow
+//   shaded    : any hit was lit at all
+// That is exact for edits of how things look: a Material, which material a Sphere uses, a light's intensity,
+// and a light's position (which can change any lit hit). Moving or resizing a sphere, an instance or a shape can
+// make it show up or cast a shadow anywhere, callers render the whole frame for that.
+class TileDependencies
+{
+public:
+	void reset(size_t tile_count) { tiles.assign(tile_count, Tile{}); }
+	size_t size() const { return tiles.size(); }
+
+	// Tiles to render again after an edit, in tile order
+	std::vector<uint32_t> sphere_changed(uint32_t sphere) const;
+	std::vector<uint32_t> material_changed(const Scene& scene, uint32_t material) const;
+	std::vector<uint32_t> light_changed(uint32_t light, bool moved) const;
+
+	// Collects what the calling thread's rays touch while it renders one tile, see render_frame
+	struct Recorder
+	{
+		std::vector<uint32_t> spheres, instances, shapes, lights;
+		bool shaded{};
+
+		static thread_local Recorder* current;	// null unless dependencies are being recorded
+	};
+	void begin_tile(Recorder& recorder) const;
+	void end_tile(size_t tile, Recorder& recorder);	// sorts the tile's lists, tiles are written by one thread each
+
+private:
+	struct Tile
+	{
+		std::vector<uint32_t> spheres, instances, shapes, lights;	// sorted, unique
+		bool shaded{};
+	};
+	std::vector<Tile> tiles;
+};
+
+// Called from the tracing code, a thread local load and a branch when nothing is recorded
+inline void record_sphere(uint32_t sphere)
+{
+	if (TileDependencies::Recorder* r = TileDependencies::Recorder::current)
+		if (r->spheres.empty() || r->spheres.back() != sphere)
+			r->spheres.push_back(sphere);
+}
+
+inline void record_instance(uint32_t instance)
+{
+	if (TileDependencies::Recorder* r = TileDependencies::Recorder::current)
+		if (r->instances.empty() || r->instances.back() != instance)
+			r->instances.push_back(instance);
+}
+
+inline void record_shape(uint32_t shape)
+{
+	if (TileDependencies::Recorder* r = TileDependencies::Recorder::current)
+		if (r->shapes.empty() || r->shapes.back() != shape)
+			r->shapes.push_back(shape);
+}
+
+inline void record_light(uint32_t light)
+{
+	if (TileDependencies::Recorder* r = TileDependencies::Recorder::current)
+	{
+		r->shaded = true;
+		if (r->lights.empty() || r->lights.back() != light)
+			r->lights.push_back(light);
+	}
+}
+
+inline void record_shaded()
+{
+	if (TileDependencies::Recorder* r = TileDependencies::Recorder::current)
+		r->shaded = true;
+}
+
+#endif
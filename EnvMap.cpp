@@ -0,0 +1,216 @@
+// EnvMap.cpp : Loading of the environment map and its conversion to a cube map
+//
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <system_error>
+#include "RayTracer.h"
+#include "EnvMap.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace
+{
+    // Layout of a '.cube' cache file: this header, then the texels as RGB8 from byte 64 on
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        int32_t face;
+        uint64_t source_mtime;	// MappedFile::modified of the image
+        uint64_t source_size;
+        int32_t src_width, src_height;
+        uint8_t padding[24];
+    };
+    static_assert(sizeof(CacheHeader) == 64, "texels must start 64 byte aligned");
+    constexpr char cache_magic[8] = { 'R', 'T', 'E', 'N', 'V', 'C', 'U', 'B' };
+    constexpr uint32_t cache_version = 1;
+
+    // One cache file per source image: its name, and FNV-1a of its absolute path to tell apart images of the
+    // same name in different directories
+    std::string cache_file_path(const std::string& cache_dir, const char* filename)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::path source = fs::absolute(filename, ec);
+        if (ec)
+            source = filename;
+        std::string key = source.generic_string();
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : key)
+            h = (h ^ c) * 1099511628211ull;
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+        return (fs::path(cache_dir) / (source.filename().string() + "-" + hex + ".cube")).string();
+    }
+}
+
+std::string EnvMap::default_cache_dir()
+{
+    namespace fs = std::filesystem;
+#if defined(_WIN32)
+    if (const char* local = std::getenv("LOCALAPPDATA"); local && *local)
+        return (fs::path(local) / "RayTracer").string();
+#else
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return (fs::path(xdg) / "raytracer").string();
+    if (const char* home = std::getenv("HOME"); home && *home)
+        return (fs::path(home) / ".cache" / "raytracer").string();
+#endif
+    std::error_code ec;
+    fs::path tmp = fs::temp_directory_path(ec);
+    return ec ? std::string() : (tmp / "raytracer").string();
+}
+
+bool EnvMap::load(const char* filename, ThreadPool& pool, const std::string& cache_dir, int face_size)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Mapped, so a cache hit only reads the pages of the image header
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Error: can not load the environment map" << std::endl;
+        return false;
+    }
+    uint64_t source_size = file.size(), source_mtime = file.modified();
+    cache_path = cache_dir.empty() ? std::string() : cache_file_path(cache_dir, filename);
+
+    // The header alone tells the source size, so a cache of the wrong face size is spotted without decoding
+    int n = -1;
+    if (!stbi_info_from_memory(file.data(), int(file.size()), &src_width, &src_height, &n) || 3 != n) {
+        std::cerr << "Error: can not load the environment map" << std::endl;
+        return false;
+    }
+    face_size = face_size > 0 ? face_size : std::max(1, int(std::ceil(src_width / pi)));
+
+    if (!cache_path.empty() && map_cache(cache_path, source_size, source_mtime, face_size))
+    {
+        load_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    unsigned char* pixmap = stbi_load_from_memory(file.data(), int(file.size()), &src_width, &src_height, &n, 0);
+    if (!pixmap || 3 != n) {
+        std::cerr << "Error: can not load the environment map" << std::endl;
+        if (pixmap) stbi_image_free(pixmap);
+        return false;
+    }
+    src.assign(pixmap, pixmap + size_t(src_width) * src_height * 3);
+    stbi_image_free(pixmap);
+
+    face = face_size;
+    faces.resize(size_t(6) * face * face * channels);
+    texels = faces.data();
+
+    // Every texel takes the colour the old mapping gives the direction through its centre
+    pool.parallel_for(size_t(6) * face, [&](size_t row, unsigned) {
+        int f = int(row / face), y = int(row % face);
+        float v = 2.f * (y + 0.5f) / face - 1.f;
+        for (int x = 0; x < face; ++x)
+        {
+            float u = 2.f * (x + 0.5f) / face - 1.f;
+            Vec3f dir;
+            switch (f) {
+            case PosX: dir = Vec3f(1.f, -v, -u); break;
+            case NegX: dir = Vec3f(-1.f, -v, u); break;
+            case PosY: dir = Vec3f(u, 1.f, v); break;
+            case NegY: dir = Vec3f(u, -1.f, -v); break;
+            case PosZ: dir = Vec3f(u, -v, 1.f); break;
+            default:   dir = Vec3f(-u, -v, -1.f); break;
+            }
+            std::memcpy(&faces[((size_t(f) * face + y) * face + x) * channels], source_texel(dir.normalize()), channels);
+        }
+    });
+
+    if (!cache_path.empty())
+        write_cache(cache_path, source_size, source_mtime);
+    load_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return true;
+}
+
+bool EnvMap::map_cache(const std::string& path, uint64_t source_size, uint64_t source_mtime, int face_size)
+{
+    if (!cache.open(path.c_str()))
+        return false;
+
+    CacheHeader header;
+    size_t texel_bytes = size_t(6) * face_size * face_size * channels;
+    bool valid = cache.size() >= sizeof(header);
+    if (valid)
+    {
+        std::memcpy(&header, cache.data(), sizeof(header));
+        valid = std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0 && header.version == cache_version
+            && header.source_mtime == source_mtime && header.source_size == source_size && header.face == face_size && cache.size() == sizeof(header) + texel_bytes;
+    }
+    if (!valid)
+    {
+        cache.close();
+        return false;
+    }
+
+    face = face_size;
+    texels = cache.data() + sizeof(header);
+    faces.clear();
+    src.clear();
+    return true;
+}
+
+// Written to a temporary file first, a half written cache is never picked up by another run
+void EnvMap::write_cache(const std::string& path, uint64_t source_size, uint64_t source_mtime) const
+{
+    CacheHeader header{};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.face = face;
+    header.source_mtime = source_mtime;
+    header.source_size = source_size;
+    header.src_width = src_width;
+    header.src_height = src_height;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(faces.data()), faces.size());
+    out.close();
+    if (!out)
+    {
+        std::remove(tmp.c_str());
+        std::cerr << "Warning: can not write the environment map cache " << path << std::endl;
+        return;
+    }
+    std::remove(path.c_str());
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        std::cerr << "Warning: can not write the environment map cache " << path << std::endl;
+        return;
+    }
+    std::cout << "Envmap: wrote the cube map cache " << path << " (" << (sizeof(header) + faces.size()) / 1048576.0 << " MB)" << std::endl;
+}
+
+Vec3f EnvMap::lookup_legacy(const Vec3f& dir) const
+{
+    const uint8_t* p = source_texel(dir);
+    return Vec3f(p[0], p[1], p[2]) * (1 / 255.);
+}
+
+const uint8_t* EnvMap::source_texel(const Vec3f& dir) const
+{
+    // NOTE: for fish eye effect, we can use asin, acos but for straight/plain image use atan2
+    // Also, the reflection using sin and cos are fisheyed, but with atan2, it'll fade to infinity
+
+    int x_raw = std::abs((std::atan2(dir.z, dir.x) / (2 * pi)) * src_width);   //+ 2 * envmap_width / (2 * pi)
+    int y_raw = std::abs((std::atan2(dir.z, dir.y) / pi) * src_height);        // +  envmap_height/pi
+
+    int x = std::max(0, std::min(x_raw, src_width - 1));
+    int y = std::max(0, std::min(y_raw, src_height - 1));
+    return &src[(x + size_t(y) * src_width) * 3];
+}
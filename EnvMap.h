@@ -0,0 +1,132 @@
+#ifndef ENVMAP_H
+#define ENVMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include "Geometry.h"
+#include "MappedFile.h"
+
+class ThreadPool;
+
+// Environment map seen by every ray that misses the scene.
+// The source image is resampled once at load time into a cube map, so a lookup is only a major axis
+// pick, one divide and a fetch instead of two atan2 per miss. The cube is filled through the original
+// atan2 mapping (lookup_legacy), so the background is the same image but resampled, not the same pixels:
+// on the default frame about a fifth of the bytes move, by 1.8 levels on average and by up to 158 on the
+// sharp edges of the sky image, where a neighbouring source texel gets picked.
+// The finished cube is saved as '<image name>-<hash of its path>.cube' in a cache directory (--envmap-cache,
+// by default default_cache_dir()), keyed on the size and modification time of the image. The texels stay
+// RGB8 like the image, so the cache loses nothing. Later runs memory map that file instead of decoding the
+// JPEG, so startup no longer depends on the image size.
+class EnvMap
+{
+public:
+	static constexpr int channels = 3;
+	enum Face { PosX, NegX, PosY, NegY, PosZ, NegZ };
+
+	bool bilinear = false;	// filter between the four nearest texels of a face, nearest texel otherwise
+
+	// Maps the cached cube of the image, or decodes the image, builds the cube and writes the cache into
+	// cache_dir, which is created when missing. An empty cache_dir neither reads nor writes a cache.
+	// face_size 0 picks source width / pi. An equirect row spreads 2 pi over the width and a face edge spans
+	// pi / 2, so that matches the texel density of the source around the horizon
+	bool load(const char* filename, ThreadPool& pool, const std::string& cache_dir, int face_size = 0);
+
+	// The user's cache directory: %LOCALAPPDATA%\RayTracer, $XDG_CACHE_HOME/raytracer or ~/.cache/raytracer,
+	// the temp directory when none of them is set
+	static std::string default_cache_dir();
+
+	Vec3f lookup(const Vec3f& dir) const { return lookup(dir, bilinear); }
+
+	// Same with the filtering picked by the caller instead of the 'bilinear' setting
+	Vec3f lookup(const Vec3f& dir, bool filtered) const
+	{
+		int face;
+		float u, v;
+		cube_coords(dir, face, u, v);
+		return filtered ? sample_bilinear(face, u, v) : sample_nearest(face, u, v);
+	}
+
+	// The original equirect lookup of background_color, kept as the reference and to fill the cube.
+	// Only available when the image was decoded, i.e. not when the cube came from the cache
+	Vec3f lookup_legacy(const Vec3f& dir) const;
+	bool has_source() const { return !src.empty(); }
+
+	int size() const { return face; }
+	bool empty() const { return texels == nullptr; }
+	bool from_cache() const { return cache.is_open(); }
+	const std::string& cache_file() const { return cache_path; }	// empty without a cache
+	double load_ms{};
+
+private:
+	int face{};					// texels per cube face edge
+	const uint8_t* texels{};	// 6 faces of face x face RGB8 texels, in Face order. Points into 'faces' or 'cache'
+	std::vector<uint8_t> faces;
+	MappedFile cache;
+	std::string cache_path;
+
+	int src_width{}, src_height{};
+	std::vector<uint8_t> src;	// decoded source image, RGB8
+
+	bool map_cache(const std::string& path, uint64_t source_size, uint64_t source_mtime, int face_size);
+	void write_cache(const std::string& path, uint64_t source_size, uint64_t source_mtime) const;
+
+	// Texel of the source image the original atan2 mapping picks for a direction
+	const uint8_t* source_texel(const Vec3f& dir) const;
+
+	// Face and texel space coordinates in [0, face] of a direction
+	void cube_coords(const Vec3f& d, int& f, float& u, float& v) const
+	{
+		float ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+		float ma, sc, tc;
+		if (ax >= ay && ax >= az)
+		{
+			f = d.x < 0 ? NegX : PosX;
+			ma = ax; sc = d.x < 0 ? d.z : -d.z; tc = -d.y;
+		}
+		else if (ay >= az)
+		{
+			f = d.y < 0 ? NegY : PosY;
+			ma = ay; sc = d.x; tc = d.y < 0 ? -d.z : d.z;
+		}
+		else
+		{
+			f = d.z < 0 ? NegZ : PosZ;
+			ma = az; sc = d.z < 0 ? -d.x : d.x; tc = -d.y;
+		}
+		float scale = 0.5f * face / ma;
+		u = sc * scale + 0.5f * face;
+		v = tc * scale + 0.5f * face;
+	}
+
+	const uint8_t* texel(int f, int x, int y) const { return texels + ((size_t(f) * face + y) * face + x) * channels; }
+
+	Vec3f sample_nearest(int f, float u, float v) const
+	{
+		int x = std::min(int(u), face - 1), y = std::min(int(v), face - 1);
+		const uint8_t* t = texel(f, x, y);
+		return Vec3f(t[0], t[1], t[2]) * (1 / 255.);
+	}
+
+	// Filtering stays inside the face, at the seams the edge texels are repeated
+	Vec3f sample_bilinear(int f, float u, float v) const
+	{
+		u = std::max(0.f, std::min(u - 0.5f, face - 1.f));
+		v = std::max(0.f, std::min(v - 0.5f, face - 1.f));
+		int x0 = int(u), y0 = int(v);
+		int x1 = std::min(x0 + 1, face - 1), y1 = std::min(y0 + 1, face - 1);
+		float fx = u - x0, fy = v - y0;
+
+		const uint8_t* a = texel(f, x0, y0), * b = texel(f, x1, y0), * c = texel(f, x0, y1), * d = texel(f, x1, y1);
+		float s = 1 / 255.f;
+		float w00 = (1 - fx) * (1 - fy) * s, w10 = fx * (1 - fy) * s, w01 = (1 - fx) * fy * s, w11 = fx * fy * s;
+		return Vec3f(a[0] * w00 + b[0] * w10 + c[0] * w01 + d[0] * w11,
+			a[1] * w00 + b[1] * w10 + c[1] * w01 + d[1] * w11,
+			a[2] * w00 + b[2] * w10 + c[2] * w01 + d[2] * w11);
+	}
+};
+
+#endif
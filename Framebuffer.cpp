@@ -0,0 +1,35 @@
+// Framebuffer.cpp : Storage of the Framebuffer declared in Framebuffer.h
+//
+
+#include <new>
+#include <cstring>
+#include "Framebuffer.h"
+
+void Framebuffer::resize(int width, int height)
+{
+    size_t needed = size_t(width) * size_t(height) * channels;
+    if (needed > capacity)
+    {
+        release();
+        pixels = static_cast<float*>(::operator new(needed * sizeof(float), std::align_val_t(alignment)));
+        capacity = needed;
+    }
+    w = width;
+    h = height;
+    if (!moments.empty())
+        moments.resize(pixel_count());
+}
+
+void Framebuffer::clear()
+{
+    if (pixels)
+        std::memset(pixels, 0, pixel_count() * channels * sizeof(float));
+}
+
+void Framebuffer::release()
+{
+    if (pixels)
+        ::operator delete(pixels, std::align_val_t(alignment));
+    pixels = nullptr;
+    capacity = 0;
+}
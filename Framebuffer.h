@@ -0,0 +1,108 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
+#include "Geometry.h"
+
+// Linear RGB float image in one 64 byte aligned allocation, rows stored top to bottom.
+// resize() only reallocates when the frame grows, so one Framebuffer can be reused for every frame.
+class Framebuffer
+{
+public:
+	static constexpr size_t alignment = 64;
+	static constexpr int channels = 3;
+
+	Framebuffer() = default;
+	Framebuffer(int width, int height) { resize(width, height); }
+	~Framebuffer() { release(); }
+
+	Framebuffer(const Framebuffer&) = delete;
+	Framebuffer& operator=(const Framebuffer&) = delete;
+
+	void resize(int width, int height);
+	void clear();
+
+	int width() const { return w; }
+	int height() const { return h; }
+	size_t pixel_count() const { return size_t(w) * size_t(h); }
+
+	float* row(int y) { return pixels + size_t(y) * w * channels; }
+	const float* row(int y) const { return pixels + size_t(y) * w * channels; }
+	float* data() { return pixels; }
+	const float* data() const { return pixels; }
+
+	void set(int x, int y, const Vec3f& c)
+	{
+		float* p = row(y) + x * channels;
+		p[0] = c.x; p[1] = c.y; p[2] = c.z;
+	}
+
+	// Folds the sum of samples first .. first + count - 1 of a pixel into the mean of the earlier samples it holds.
+	// With track_variance() on, also adds count * L^2 of the pass to the pixel's moment, L the display_luminance
+	// of the pass mean
+	void add_samples(int x, int y, const Vec3f& sum, int first, int count)
+	{
+		if (!moments.empty())
+		{
+			float l = display_luminance(sum * (1.f / count));
+			float& m = moments[size_t(y) * w + x];
+			m = (first == 0 ? 0.f : m) + count * l * l;
+		}
+		if (first == 0)
+		{
+			set(x, y, sum * (1.f / count));
+			return;
+		}
+		float n = float(first + count);
+		set(x, y, get(x, y) * (first / n) + sum * (1.f / n));
+	}
+
+	// Pass moments for adaptive sampling, filled by add_samples from the next first pass (first == 0) on
+	void track_variance() { moments.resize(pixel_count()); }
+
+	// Standard error of a pixel's mean display luminance, after 'passes' passes of 'samples' samples in total.
+	// Each pass mean L_k of c_k samples has variance sigma^2 / c_k, so sum(c_k L_k^2) - samples * mean^2 estimates
+	// (passes - 1) sigma^2, the per sample variance. Needs at least two passes
+	float standard_error(int x, int y, int passes, int samples) const
+	{
+		float l = display_luminance(get(x, y));
+		float variance = (moments[size_t(y) * w + x] - samples * l * l) / (passes - 1);
+		return std::sqrt(std::max(0.f, variance) / samples);
+	}
+
+	// Brightness of a colour as it is written (see quantise), in [0, 1]
+	static float display_luminance(const Vec3f& c)
+	{
+		float max = std::max(c.x, std::max(c.y, c.z));
+		float scale = max > 1 ? 1.f / max : 1.f;
+		return std::max(0.f, std::min(1.f, (0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z) * scale));
+	}
+
+	Vec3f get(int x, int y) const
+	{
+		const float* p = row(y) + x * channels;
+		return Vec3f(p[0], p[1], p[2]);
+	}
+
+	// 8 bit value of a channel as the image is written: colours brighter than 1 are scaled down by
+	// their largest channel, then clamped to [0, 1]
+	static unsigned char quantise(const float* rgb, int k)
+	{
+		float max = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+		float c = max > 1 ? float(rgb[k] * (1. / max)) : rgb[k];
+		return (unsigned char)(255 * std::max(0.f, std::min(1.f, c)));
+	}
+
+private:
+	float* pixels{};
+	size_t capacity{};	// in floats
+	std::vector<float> moments;	// per pixel, empty unless track_variance()
+	int w{}, h{};
+
+	void release();
+};
+
+#endif
@@ -0,0 +1,347 @@
+// ImageWriter.cpp : Quantisation of the framebuffer and the PPM / PNG encoders declared in ImageWriter.h
+//
+
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "Framebuffer.h"
+#include "ThreadPool.h"
+#include "ImageWriter.h"
+
+void quantise_frame(const Framebuffer& frame, ThreadPool& pool, std::vector<uint8_t>& rgb)
+{
+    int w = frame.width();
+    rgb.resize(frame.pixel_count() * 3);
+    pool.parallel_for(size_t(frame.height()), [&](size_t j, unsigned) {
+        const float* row = frame.row(int(j));
+        uint8_t* out = &rgb[j * w * 3];
+        for (int i = 0; i < w; ++i)
+        {
+            const float* p = row + i * Framebuffer::channels;
+            out[i * 3 + 0] = Framebuffer::quantise(p, 0);
+            out[i * 3 + 1] = Framebuffer::quantise(p, 1);
+            out[i * 3 + 2] = Framebuffer::quantise(p, 2);
+        }
+    });
+}
+
+namespace
+{
+    bool write_all(const char* filename, const std::vector<uint8_t>& bytes)
+    {
+        std::FILE* f = std::fopen(filename, "wb");
+        if (!f) return false;
+        bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        return std::fclose(f) == 0 && ok;
+    }
+}
+
+bool write_ppm(const char* filename, int width, int height, const std::vector<uint8_t>& rgb)
+{
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<uint8_t> file(header.size() + rgb.size());
+    std::memcpy(file.data(), header.data(), header.size());
+    std::memcpy(file.data() + header.size(), rgb.data(), rgb.size());
+    return write_all(filename, file);
+}
+
+// ******************** PNG ********************
+
+namespace
+{
+    constexpr int strip_rows = 32;
+
+    uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0)
+    {
+        static const struct Table
+        {
+            uint32_t v[256];
+            Table()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k)
+                        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    v[i] = c;
+                }
+            }
+        } table;
+
+        crc = ~crc;
+        for (size_t i = 0; i < n; ++i)
+            crc = table.v[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    constexpr uint32_t adler_base = 65521;
+
+    uint32_t adler32(const uint8_t* data, size_t n)
+    {
+        uint32_t a = 1, b = 0;
+        while (n > 0)
+        {
+            size_t chunk = std::min<size_t>(n, 5552);	// largest run that can't overflow b
+            n -= chunk;
+            for (size_t i = 0; i < chunk; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            data += chunk;
+            a %= adler_base;
+            b %= adler_base;
+        }
+        return (b << 16) | a;
+    }
+
+    // Adler-32 of A followed by B from the checksums of A and B, as zlib's adler32_combine
+    uint32_t adler32_combine(uint32_t a1, uint32_t a2, size_t len2)
+    {
+        uint32_t rem = uint32_t(len2 % adler_base);
+        uint32_t sum1 = a1 & 0xffff;
+        uint32_t sum2 = uint32_t((uint64_t(rem) * sum1) % adler_base);
+        sum1 += (a2 & 0xffff) + adler_base - 1;
+        sum2 += (a1 >> 16) + (a2 >> 16) + adler_base - rem;
+        if (sum1 >= adler_base) sum1 -= adler_base;
+        if (sum1 >= adler_base) sum1 -= adler_base;
+        if (sum2 >= 2 * adler_base) sum2 -= 2 * adler_base;
+        if (sum2 >= adler_base) sum2 -= adler_base;
+        return sum1 | (sum2 << 16);
+    }
+
+    // Deflate writes its bit stream least significant bit first
+    struct BitWriter
+    {
+        std::vector<uint8_t> out;
+        uint64_t bits{};
+        int count{};
+
+        void put(uint32_t value, int n)
+        {
+            bits |= uint64_t(value) << count;
+            count += n;
+            while (count >= 8)
+            {
+                out.push_back(uint8_t(bits));
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes go most significant bit first
+        void put_code(uint32_t code, int n)
+        {
+            uint32_t rev = 0;
+            for (int i = 0; i < n; ++i)
+                rev |= ((code >> i) & 1) << (n - 1 - i);
+            put(rev, n);
+        }
+
+        void align() { if (count > 0) put(0, 8 - count); }
+    };
+
+    const uint16_t length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    // Literal / length symbol with the fixed Huffman code of RFC 1951, 3.2.6
+    void put_literal(BitWriter& bw, uint32_t sym)
+    {
+        if (sym < 144) bw.put_code(0x30 + sym, 8);
+        else if (sym < 256) bw.put_code(0x190 + sym - 144, 9);
+        else if (sym < 280) bw.put_code(sym - 256, 7);
+        else bw.put_code(0xc0 + sym - 280, 8);
+    }
+
+    void put_match(BitWriter& bw, int length, int distance)
+    {
+        int l = 28;
+        while (length_base[l] > length) --l;
+        put_literal(bw, 257 + l);
+        bw.put(length - length_base[l], length_extra[l]);
+
+        int d = 29;
+        while (dist_base[d] > distance) --d;
+        bw.put_code(d, 5);
+        bw.put(distance - dist_base[d], dist_extra[d]);
+    }
+
+    // One fixed Huffman block over 'data' with hash chain LZ77 matching inside the 32K window.
+    // A non final strip is closed with an empty stored block so the next strip starts on a byte boundary
+    std::vector<uint8_t> deflate_strip(const std::vector<uint8_t>& data, bool final)
+    {
+        constexpr int window = 32768, hash_bits = 15, max_chain = 32, min_match = 3, max_match = 258;
+
+        BitWriter bw;
+        bw.out.reserve(data.size() / 2);
+        bw.put(final ? 1 : 0, 1);
+        bw.put(1, 2);	// fixed Huffman
+
+        std::vector<int32_t> head(size_t(1) << hash_bits, -1), prev(data.size(), -1);
+        auto hash = [&](size_t i) {
+            return ((uint32_t(data[i]) << 10) ^ (uint32_t(data[i + 1]) << 5) ^ data[i + 2]) & ((1u << hash_bits) - 1);
+        };
+        auto insert = [&](size_t i) {
+            if (i + min_match > data.size()) return;
+            uint32_t h = hash(i);
+            prev[i] = head[h];
+            head[h] = int32_t(i);
+        };
+
+        size_t i = 0, n = data.size();
+        while (i < n)
+        {
+            int best_len = 0, best_dist = 0;
+            if (i + min_match <= n)
+            {
+                int limit = int(std::min<size_t>(max_match, n - i));
+                int chain = max_chain;
+                for (int32_t c = head[hash(i)]; c >= 0 && int(i - c) <= window && chain-- > 0; c = prev[c])
+                {
+                    if (data[c + best_len] != data[i + best_len]) continue;
+                    int len = 0;
+                    while (len < limit && data[c + len] == data[i + len]) ++len;
+                    if (len > best_len)
+                    {
+                        best_len = len;
+                        best_dist = int(i - c);
+                        if (len == limit) break;
+                    }
+                }
+            }
+
+            if (best_len >= min_match)
+            {
+                put_match(bw, best_len, best_dist);
+                for (int k = 0; k < best_len; ++k)
+                    insert(i + k);
+                i += best_len;
+            }
+            else
+            {
+                put_literal(bw, data[i]);
+                insert(i);
+                ++i;
+            }
+        }
+        put_literal(bw, 256);
+
+        if (!final)
+        {
+            bw.put(0, 3);	// BFINAL 0, stored
+            bw.align();
+            const uint8_t empty[4] = { 0x00, 0x00, 0xff, 0xff };
+            bw.out.insert(bw.out.end(), empty, empty + 4);
+        }
+        bw.align();
+        return bw.out;
+    }
+
+    uint8_t paeth(int a, int b, int c)
+    {
+        int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        return uint8_t(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+    }
+
+    // Filters one row with each PNG filter and keeps the one with the smallest sum of absolute values
+    void filter_row(const uint8_t* row, const uint8_t* above, size_t len, std::vector<uint8_t>& out)
+    {
+        const size_t bpp = 3;
+
+        std::vector<uint8_t> best, trial(len);
+        uint64_t best_score = ~0ull;
+        int best_type = 0;
+        for (int type = 0; type < 5; ++type)
+        {
+            uint64_t score = 0;
+            for (size_t x = 0; x < len; ++x)
+            {
+                int a = x >= bpp ? row[x - bpp] : 0;
+                int b = above ? above[x] : 0;
+                int c = above && x >= bpp ? above[x - bpp] : 0;
+                uint8_t v = row[x];
+                switch (type) {
+                case 1: v = uint8_t(v - a); break;
+                case 2: v = uint8_t(v - b); break;
+                case 3: v = uint8_t(v - ((a + b) >> 1)); break;
+                case 4: v = uint8_t(v - paeth(a, b, c)); break;
+                default: break;
+                }
+                trial[x] = v;
+                score += v < 128 ? v : 256 - v;
+            }
+            if (score < best_score)
+            {
+                best_score = score;
+                best_type = type;
+                best = trial;
+            }
+        }
+
+        out.push_back(uint8_t(best_type));
+        out.insert(out.end(), best.begin(), best.end());
+    }
+
+    void put_be32(std::vector<uint8_t>& out, uint32_t v)
+    {
+        out.push_back(uint8_t(v >> 24)); out.push_back(uint8_t(v >> 16));
+        out.push_back(uint8_t(v >> 8)); out.push_back(uint8_t(v));
+    }
+
+    void put_chunk(std::vector<uint8_t>& file, const char* type, const std::vector<uint8_t>& data)
+    {
+        put_be32(file, uint32_t(data.size()));
+        size_t start = file.size();
+        file.insert(file.end(), type, type + 4);
+        file.insert(file.end(), data.begin(), data.end());
+        put_be32(file, crc32(&file[start], file.size() - start));
+    }
+}
+
+bool write_png(const char* filename, int width, int height, const std::vector<uint8_t>& rgb, ThreadPool& pool)
+{
+    size_t stride = size_t(width) * 3;
+    size_t strips = (size_t(height) + strip_rows - 1) / strip_rows;
+    std::vector<std::vector<uint8_t>> compressed(strips);
+    std::vector<uint32_t> checksums(strips);
+    std::vector<size_t> raw_sizes(strips);
+
+    pool.parallel_for(strips, [&](size_t s, unsigned) {
+        int y0 = int(s) * strip_rows, y1 = std::min(height, y0 + strip_rows);
+        std::vector<uint8_t> filtered;
+        filtered.reserve((stride + 1) * (y1 - y0));
+        for (int y = y0; y < y1; ++y)
+            filter_row(&rgb[y * stride], y > 0 ? &rgb[(y - 1) * stride] : nullptr, stride, filtered);
+
+        checksums[s] = adler32(filtered.data(), filtered.size());
+        raw_sizes[s] = filtered.size();
+        compressed[s] = deflate_strip(filtered, s + 1 == strips);
+    });
+
+    // zlib stream: header, the strips back to back, Adler-32 of all filtered rows
+    std::vector<uint8_t> idat = { 0x78, 0x01 };
+    uint32_t adler = 1;
+    for (size_t s = 0; s < strips; ++s)
+    {
+        idat.insert(idat.end(), compressed[s].begin(), compressed[s].end());
+        adler = adler32_combine(adler, checksums[s], raw_sizes[s]);
+    }
+    put_be32(idat, adler);
+
+    std::vector<uint8_t> ihdr;
+    put_be32(ihdr, uint32_t(width));
+    put_be32(ihdr, uint32_t(height));
+    const uint8_t format[5] = { 8, 2, 0, 0, 0 };	// 8 bit, RGB, deflate, adaptive filtering, no interlace
+    ihdr.insert(ihdr.end(), format, format + 5);
+
+    const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<uint8_t> file(signature, signature + 8);
+    put_chunk(file, "IHDR", ihdr);
+    put_chunk(file, "IDAT", idat);
+    put_chunk(file, "IEND", {});
+    return write_all(filename, file);
+}
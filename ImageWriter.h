@@ -0,0 +1,22 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <vector>
+#include <cstdint>
+
+class Framebuffer;
+class ThreadPool;
+
+// Tone maps and quantises the frame into packed 8 bit RGB, rows in parallel. Same bytes as
+// Framebuffer::quantise gives channel by channel
+void quantise_frame(const Framebuffer& frame, ThreadPool& pool, std::vector<uint8_t>& rgb);
+
+// Binary PPM (P6), header and pixels leave in one write
+bool write_ppm(const char* filename, int width, int height, const std::vector<uint8_t>& rgb);
+
+// 8 bit RGB PNG. The rows are cut into strips that are filtered and deflated in parallel, every strip
+// ends byte aligned (empty stored block) so the compressed strips simply follow each other in one IDAT.
+// Strips don't share their LZ77 window, which costs a little size for the parallelism.
+bool write_png(const char* filename, int width, int height, const std::vector<uint8_t>& rgb, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Read only memory mapping of a whole file. Pages are loaded by the OS on first touch, so opening a large
+// file costs next to nothing until its contents are actually read.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* filename);
+	void close();
+
+	bool is_open() const { return bytes != nullptr; }
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+	// Last write time of the file when it was opened, in the platform's own units. Only good for telling
+	// whether a file changed between runs
+	uint64_t modified() const { return mtime; }
+
+private:
+	const uint8_t* bytes{};
+	size_t length{};
+	uint64_t mtime{};
+#if defined(_WIN32)
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
+
+#endif
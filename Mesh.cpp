@@ -0,0 +1,127 @@
+// Mesh.cpp : Triangle mesh BVH and intersection, and mesh instances, declared in Mesh.h
+//
+
+#include <cmath>
+#include "Mesh.h"
+
+void TriangleMesh::build()
+{
+    size_t n = triangle_count();
+    std::vector<AABB> prim_bounds(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        AABB b;
+        for (int k = 0; k < 3; ++k)
+            b.expand(vertex(indices[3 * i + k]));
+        prim_bounds[i] = b;
+    }
+    bvh.build(prim_bounds);
+
+    triangles.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint32_t* tri = &indices[3 * size_t(bvh.prim_indices[i])];
+        Vec3f a = vertex(tri[0]);
+        Vec3f e1 = vertex(tri[1]) - a, e2 = vertex(tri[2]) - a;
+        triangles[i] = Triangle{ { a.x, a.y, a.z }, { e1.x, e1.y, e1.z }, { e2.x, e2.y, e2.z } };
+    }
+}
+
+// Moller-Trumbore. Rays parallel to the triangle and degenerate triangles have det 0 or miss the barycentric
+// range, hits behind the origin are rejected
+bool TriangleMesh::intersect(const Triangle& tri, const Vec3f& orig, const Vec3f& dir, float& t)
+{
+    Vec3f e1(tri.e1[0], tri.e1[1], tri.e1[2]), e2(tri.e2[0], tri.e2[1], tri.e2[2]);
+    Vec3f p = cross(dir, e2);
+    float det = e1 * p;
+    if (det == 0.f) return false;
+    float inv_det = 1.f / det;
+
+    Vec3f s = orig - Vec3f(tri.v0[0], tri.v0[1], tri.v0[2]);
+    float u = (s * p) * inv_det;
+    if (u < 0.f || u > 1.f) return false;
+
+    Vec3f q = cross(s, e1);
+    float v = (dir * q) * inv_det;
+    if (v < 0.f || u + v > 1.f) return false;
+
+    t = (e2 * q) * inv_det;
+    return t > 0.f;
+}
+
+size_t TriangleMesh::memory_bytes() const
+{
+    return positions.capacity() * sizeof(float) + indices.capacity() * sizeof(uint32_t) + triangles.capacity() * sizeof(Triangle)
+        + bvh.nodes.capacity() * sizeof(BVHNode) + bvh.prim_indices.capacity() * sizeof(uint32_t);
+}
+
+bool TriangleMesh::closest_hit(const Vec3f& orig, const Vec3f& dir, float& t_max, uint32_t& triangle) const
+{
+    bool hit = false;
+    bvh.traverse(orig, dir, t_max, [&](uint32_t first, uint32_t count, float& t_closest) {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            float t;
+            if (intersect(triangles[i], orig, dir, t) && t < t_closest)
+            {
+                t_closest = t;
+                triangle = i;
+                hit = true;
+            }
+        }
+    });
+    return hit;
+}
+
+bool TriangleMesh::any_hit(const Vec3f& orig, const Vec3f& dir, float t_max) const
+{
+    return bvh.traverse_any(orig, dir, t_max, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            float t;
+            if (intersect(triangles[i], orig, dir, t) && t < t_max)
+                return true;
+        }
+        return false;
+    });
+}
+
+Vec3f TriangleMesh::normal(uint32_t triangle) const
+{
+    const Triangle& tri = triangles[triangle];
+    return cross(Vec3f(tri.e1[0], tri.e1[1], tri.e1[2]), Vec3f(tri.e2[0], tri.e2[1], tri.e2[2])).normalize();
+}
+
+// The rows of the inverse of a 3x3 matrix are its column cofactors over the determinant, the cofactor columns
+// being cross products of the rows
+Transform Transform::inverse() const
+{
+    Vec3f c0 = cross(row[1], row[2]), c1 = cross(row[2], row[0]), c2 = cross(row[0], row[1]);
+    float inv_det = 1.f / (row[0] * c0);
+    Transform inv;
+    inv.row[0] = Vec3f(c0.x, c1.x, c2.x) * inv_det;
+    inv.row[1] = Vec3f(c0.y, c1.y, c2.y) * inv_det;
+    inv.row[2] = Vec3f(c0.z, c1.z, c2.z) * inv_det;
+    inv.translation = -inv.vector(translation);
+    return inv;
+}
+
+AABB Transform::apply(const AABB& b) const
+{
+    AABB out;
+    for (int corner = 0; corner < 8; ++corner)
+        out.expand(point(Vec3f(corner & 1 ? b.hi.x : b.lo.x, corner & 2 ? b.hi.y : b.lo.y, corner & 4 ? b.hi.z : b.lo.z)));
+    return out;
+}
+
+void MeshInstance::place(const TriangleMesh& m)
+{
+    float radians = rotation * 3.14159265358979323846f / 180.f;
+    float c = std::cos(radians) * scale, s = std::sin(radians) * scale;
+    to_world.row[0] = Vec3f(c, 0.f, s);
+    to_world.row[1] = Vec3f(0.f, scale, 0.f);
+    to_world.row[2] = Vec3f(-s, 0.f, c);
+    to_world.translation = position;
+    to_object = to_world.inverse();
+    bounds = m.bvh.empty() ? AABB() : to_world.apply(m.bounds());
+}
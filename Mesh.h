@@ -0,0 +1,96 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "Geometry.h"
+#include "BVH.h"
+
+// Indexed triangle mesh, the bottom level of the Scene's two level structure: the geometry once, in the
+// coordinates of its file, with as many MeshInstances placing it in the world as the scene wants.
+// A loader (see MeshFile.h) fills the vertex and index buffers, build() then puts a BVH over the triangles and
+// keeps a copy of every triangle in BVH leaf order as one vertex and two edges, what the Moller-Trumbore test
+// needs, so a leaf is a contiguous run. Normals are geometric, on the side the vertices go counter clockwise
+// around. The test is two sided and works for any ray direction, unit length or not.
+class TriangleMesh
+{
+public:
+	std::vector<float> positions;	// x y z per vertex
+	std::vector<uint32_t> indices;	// 3 per triangle, vertex numbers
+	std::string source;				// the file, what save_scene writes instead of the triangles
+
+	size_t vertex_count() const { return positions.size() / 3; }
+	size_t triangle_count() const { return indices.size() / 3; }
+
+	// Builds the BVH and the leaf ordered triangles, again after the buffers changed
+	void build();
+
+	// Heap bytes of the buffers, the leaf ordered triangles and the BVH, what every copy would cost without instancing
+	size_t memory_bytes() const;
+
+	AABB bounds() const { return bvh.empty() ? AABB() : bvh.nodes[0].bounds(); }
+
+	// Closest triangle in front of t_max: shrinks t_max and sets 'triangle' to its leaf order index, see normal()
+	bool closest_hit(const Vec3f& orig, const Vec3f& dir, float& t_max, uint32_t& triangle) const;
+	// Any triangle in front of t_max, for shadow rays
+	bool any_hit(const Vec3f& orig, const Vec3f& dir, float t_max) const;
+
+	// Unit normal of a triangle closest_hit found
+	Vec3f normal(uint32_t triangle) const;
+
+	BVH bvh;
+
+private:
+	struct Triangle { float v0[3], e1[3], e2[3]; };
+	static_assert(sizeof(Triangle) == 36, "Triangle must have no padding");
+	std::vector<Triangle> triangles;	// BVH leaf order
+
+	static bool intersect(const Triangle& tri, const Vec3f& orig, const Vec3f& dir, float& t);
+
+	Vec3f vertex(uint32_t v) const { return Vec3f(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]); }
+};
+
+// Affine map, a 3x3 matrix by rows and a translation: p -> (row[0] * p, row[1] * p, row[2] * p) + translation
+struct Transform
+{
+	Vec3f row[3]{ Vec3f(1.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f), Vec3f(0.f, 0.f, 1.f) };
+	Vec3f translation{};
+
+	Vec3f vector(const Vec3f& v) const { return Vec3f(row[0] * v, row[1] * v, row[2] * v); }
+	Vec3f point(const Vec3f& p) const { return vector(p) + translation; }
+
+	Transform inverse() const;
+	AABB apply(const AABB& b) const;	// box around the 8 mapped corners
+};
+
+// One placement of a TriangleMesh in the world, the top level of the Scene's two level structure. The mesh is
+// turned about its y axis, scaled and then moved, so normals map like directions (no shear, no uneven scale).
+// Rays are taken into the mesh's coordinates without normalising the direction, which keeps the distances
+// along the ray the same in both spaces and lets a hit shrink the world t_max directly.
+struct MeshInstance
+{
+	uint32_t mesh{};			// index into Scene::meshes
+	uint32_t material{};		// index into Scene::materials
+	Vec3f position{};
+	float scale = 1.f;
+	float rotation{};			// degrees about y
+
+	Transform to_world, to_object;
+	AABB bounds;				// in the world, what the top level BVH is built over
+
+	// Sets the transforms and the bounds from position, scale and rotation, again after they changed
+	void place(const TriangleMesh& m);
+
+	bool closest_hit(const TriangleMesh& m, const Vec3f& orig, const Vec3f& dir, float& t_max, uint32_t& triangle) const
+	{
+		return m.closest_hit(to_object.point(orig), to_object.vector(dir), t_max, triangle);
+	}
+	bool any_hit(const TriangleMesh& m, const Vec3f& orig, const Vec3f& dir, float t_max) const
+	{
+		return m.any_hit(to_object.point(orig), to_object.vector(dir), t_max);
+	}
+	Vec3f normal(const TriangleMesh& m, uint32_t triangle) const { return to_world.vector(m.normal(triangle)).normalize(); }
+};
+
+#endif
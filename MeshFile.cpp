@@ -0,0 +1,653 @@
+// MeshFile.cpp : OBJ and PLY loaders declared in MeshFile.h
+//
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "SceneFile.h"
+#include "Mesh.h"
+#include "MeshFile.h"
+
+namespace
+{
+    constexpr size_t items_per_task = 1 << 16;
+
+    bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    // Splits the text at line ends into chunks of at least 64 KB, a few per worker so uneven lines still balance
+    std::vector<std::pair<const char*, const char*>> split_lines(const char* text, size_t size, unsigned workers)
+    {
+        size_t count = std::max<size_t>(1, std::min<size_t>(size / (64 << 10), size_t(workers) * 4));
+        std::vector<std::pair<const char*, const char*>> chunks(count);
+        const char* start = text;
+        for (size_t c = 0; c < count; ++c)
+        {
+            const char* stop = text + size * (c + 1) / count;
+            if (c + 1 == count)
+                stop = text + size;
+            else if (stop < start)
+                stop = start;
+            else
+            {
+                const char* nl = static_cast<const char*>(std::memchr(stop, '\n', text + size - stop));
+                stop = nl ? nl + 1 : text + size;
+            }
+            chunks[c] = { start, stop };
+            start = stop;
+        }
+        return chunks;
+    }
+
+    // Triangles of a polygon as a fan around its first corner
+    template <class T>
+    void add_fan(const std::vector<T>& polygon, std::vector<T>& corners)
+    {
+        for (size_t k = 1; k + 1 < polygon.size(); ++k)
+        {
+            corners.push_back(polygon[0]);
+            corners.push_back(polygon[k]);
+            corners.push_back(polygon[k + 1]);
+        }
+    }
+
+    // ******************** OBJ ********************
+
+    // A negative OBJ index counts back from the last vertex read so far. Until every chunk's vertex count is
+    // known it is kept relative to the chunk's first vertex, moved up by this bias to tell it from a 0 based one
+    constexpr int64_t relative_bias = int64_t(1) << 48;
+
+    struct ObjChunk
+    {
+        const char* begin{}, * end{};
+        size_t lines{};
+
+        std::vector<float> positions;
+        std::vector<int64_t> corners;	// 3 per triangle, 0 based vertex numbers or relative_bias + number in this chunk
+
+        std::string error;
+        size_t error_line{};	// 1 based within the chunk
+
+        void parse();
+    };
+
+    void ObjChunk::parse()
+    {
+        std::vector<int64_t> polygon;
+        for (const char* line = begin; line < end; ++lines)
+        {
+            const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+            if (!line_end) line_end = end;
+            const char* p = line;
+            while (p < line_end && is_space(*p)) ++p;
+
+            if (line_end - p > 1 && p[0] == 'v' && is_space(p[1]))
+            {
+                p += 2;
+                for (int k = 0; k < 3; ++k)
+                {
+                    while (p < line_end && is_space(*p)) ++p;
+                    double v;
+                    if (!parse_number(p, line_end, v))
+                    {
+                        error = "malformed vertex";
+                        error_line = lines + 1;
+                        return;
+                    }
+                    positions.push_back(float(v));
+                }
+            }
+            else if (line_end - p > 1 && p[0] == 'f' && is_space(p[1]))
+            {
+                p += 2;
+                polygon.clear();
+                int64_t vertices = int64_t(positions.size() / 3);
+                while (true)
+                {
+                    while (p < line_end && is_space(*p)) ++p;
+                    if (p == line_end || *p == '#') break;
+
+                    // v, v/vt, v//vn or v/vt/vn, only v matters
+                    bool negative = *p == '-';
+                    if (negative || *p == '+') ++p;
+                    int64_t index = 0;
+                    const char* digits = p;
+                    while (p < line_end && *p >= '0' && *p <= '9' && index < relative_bias / 4)
+                        index = index * 10 + (*p++ - '0');
+                    if (p == digits || index == 0 || index >= relative_bias / 4)
+                    {
+                        error = "malformed face";
+                        error_line = lines + 1;
+                        return;
+                    }
+                    while (p < line_end && !is_space(*p)) ++p;
+                    polygon.push_back(negative ? relative_bias + vertices - index : index - 1);
+                }
+                if (polygon.size() < 3)
+                {
+                    error = "face with fewer than 3 vertices";
+                    error_line = lines + 1;
+                    return;
+                }
+                add_fan(polygon, corners);
+            }
+            line = line_end + 1;
+        }
+    }
+
+    bool load_obj(const char* filename, const MappedFile& file, ThreadPool& pool, TriangleMesh& mesh)
+    {
+        auto ranges = split_lines(reinterpret_cast<const char*>(file.data()), file.size(), pool.size());
+        size_t count = ranges.size();
+        std::vector<ObjChunk> chunks(count);
+        for (size_t c = 0; c < count; ++c)
+        {
+            chunks[c].begin = ranges[c].first;
+            chunks[c].end = ranges[c].second;
+        }
+
+        pool.parallel_for(count, [&](size_t c, unsigned) { chunks[c].parse(); });
+
+        size_t line_base = 0;
+        for (const ObjChunk& c : chunks)
+        {
+            if (!c.error.empty())
+            {
+                std::cerr << "Error: " << filename << ":" << line_base + c.error_line << ": " << c.error << std::endl;
+                return false;
+            }
+            line_base += c.lines;
+        }
+
+        // Every chunk's vertices and triangles go to their place in the buffers side by side
+        std::vector<size_t> vertex_base(count + 1), corner_base(count + 1);
+        for (size_t c = 0; c < count; ++c)
+        {
+            vertex_base[c + 1] = vertex_base[c] + chunks[c].positions.size() / 3;
+            corner_base[c + 1] = corner_base[c] + chunks[c].corners.size();
+        }
+        int64_t vertices = int64_t(vertex_base[count]);
+        if (vertices > int64_t(UINT32_MAX))
+        {
+            std::cerr << "Error: " << filename << " has more than " << UINT32_MAX << " vertices" << std::endl;
+            return false;
+        }
+
+        mesh.positions.resize(vertex_base[count] * 3);
+        mesh.indices.resize(corner_base[count]);
+        std::vector<uint8_t> bad(count);
+        pool.parallel_for(count, [&](size_t c, unsigned) {
+            const ObjChunk& chunk = chunks[c];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + vertex_base[c] * 3);
+            uint32_t* out = mesh.indices.data() + corner_base[c];
+            for (int64_t corner : chunk.corners)
+            {
+                int64_t v = corner >= relative_bias / 2 ? int64_t(vertex_base[c]) + (corner - relative_bias) : corner;
+                bad[c] |= v < 0 || v >= vertices;
+                *out++ = uint32_t(v);
+            }
+        });
+        if (std::find(bad.begin(), bad.end(), uint8_t(1)) != bad.end())
+        {
+            std::cerr << "Error: " << filename << ": a face refers to a vertex that does not exist" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // ******************** PLY ********************
+
+    enum class PlyFormat { Ascii, LittleEndian, BigEndian };
+    enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+    bool ply_type(const std::string& name, PlyType& type)
+    {
+        static const struct { const char* name; PlyType type; } names[] = {
+            { "char", PlyType::Int8 }, { "int8", PlyType::Int8 }, { "uchar", PlyType::UInt8 }, { "uint8", PlyType::UInt8 },
+            { "short", PlyType::Int16 }, { "int16", PlyType::Int16 }, { "ushort", PlyType::UInt16 }, { "uint16", PlyType::UInt16 },
+            { "int", PlyType::Int32 }, { "int32", PlyType::Int32 }, { "uint", PlyType::UInt32 }, { "uint32", PlyType::UInt32 },
+            { "float", PlyType::Float32 }, { "float32", PlyType::Float32 }, { "double", PlyType::Float64 }, { "float64", PlyType::Float64 } };
+        for (const auto& n : names)
+        {
+            if (name == n.name)
+            {
+                type = n.type;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t ply_size(PlyType type)
+    {
+        switch (type)
+        {
+        case PlyType::Int8: case PlyType::UInt8: return 1;
+        case PlyType::Int16: case PlyType::UInt16: return 2;
+        case PlyType::Float64: return 8;
+        default: return 4;
+        }
+    }
+
+    // Value of 'type' at p, byte swapped for a big endian file
+    double read_value(const uint8_t* p, PlyType type, bool swap)
+    {
+        uint8_t b[8];
+        size_t n = ply_size(type);
+        for (size_t i = 0; i < n; ++i)
+            b[i] = swap ? p[n - 1 - i] : p[i];
+        switch (type)
+        {
+        case PlyType::Int8: { int8_t v; std::memcpy(&v, b, 1); return v; }
+        case PlyType::UInt8: return b[0];
+        case PlyType::Int16: { int16_t v; std::memcpy(&v, b, 2); return v; }
+        case PlyType::UInt16: { uint16_t v; std::memcpy(&v, b, 2); return v; }
+        case PlyType::Int32: { int32_t v; std::memcpy(&v, b, 4); return v; }
+        case PlyType::UInt32: { uint32_t v; std::memcpy(&v, b, 4); return v; }
+        case PlyType::Float32: { float v; std::memcpy(&v, b, 4); return v; }
+        default: { double v; std::memcpy(&v, b, 8); return v; }
+        }
+    }
+
+    struct PlyProperty
+    {
+        std::string name;
+        PlyType type{};			// of the list items for a list
+        bool is_list{};
+        PlyType count_type{};
+    };
+
+    struct PlyElement
+    {
+        std::string name;
+        size_t count{};
+        std::vector<PlyProperty> properties;
+
+        int find(const char* property) const
+        {
+            for (size_t i = 0; i < properties.size(); ++i)
+                if (properties[i].name == property) return int(i);
+            return -1;
+        }
+
+        // Bytes of one item, 0 when it has a list and so varies
+        size_t stride() const
+        {
+            size_t bytes = 0;
+            for (const PlyProperty& p : properties)
+            {
+                if (p.is_list) return 0;
+                bytes += ply_size(p.type);
+            }
+            return bytes;
+        }
+    };
+
+    struct PlyHeader
+    {
+        PlyFormat format{};
+        std::vector<PlyElement> elements;
+        size_t data_start{};	// first byte after end_header
+        size_t lines{};
+        std::string error;
+    };
+
+    bool parse_ply_header(const MappedFile& file, PlyHeader& header)
+    {
+        const char* text = reinterpret_cast<const char*>(file.data());
+        const char* end = text + file.size();
+        bool has_format = false;
+        for (const char* line = text; line < end; )
+        {
+            const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+            if (!line_end) break;
+            ++header.lines;
+
+            std::vector<std::string> words;
+            for (const char* p = line; p < line_end; )
+            {
+                while (p < line_end && is_space(*p)) ++p;
+                const char* start = p;
+                while (p < line_end && !is_space(*p)) ++p;
+                if (p > start) words.emplace_back(start, p);
+            }
+            line = line_end + 1;
+
+            if (header.lines == 1)
+            {
+                if (words.size() != 1 || words[0] != "ply")
+                {
+                    header.error = "not a PLY file";
+                    return false;
+                }
+                continue;
+            }
+            if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+                continue;
+            if (words[0] == "end_header")
+            {
+                header.data_start = size_t(line - text);
+                if (!has_format)
+                    header.error = "no format line";
+                return has_format;
+            }
+
+            if (words[0] == "format" && words.size() == 3)
+            {
+                if (words[1] == "ascii") header.format = PlyFormat::Ascii;
+                else if (words[1] == "binary_little_endian") header.format = PlyFormat::LittleEndian;
+                else if (words[1] == "binary_big_endian") header.format = PlyFormat::BigEndian;
+                else
+                {
+                    header.error = "unknown format '" + words[1] + "'";
+                    return false;
+                }
+                has_format = true;
+            }
+            else if (words[0] == "element" && words.size() == 3 && words[2].find_first_not_of("0123456789") == std::string::npos && words[2].size() < 19)
+            {
+                header.elements.emplace_back();
+                header.elements.back().name = words[1];
+                header.elements.back().count = size_t(std::stoull(words[2]));
+            }
+            else if (words[0] == "property" && !header.elements.empty())
+            {
+                PlyProperty p;
+                bool ok = false;
+                if (words.size() == 5 && words[1] == "list")
+                {
+                    p.is_list = true;
+                    p.name = words[4];
+                    ok = ply_type(words[2], p.count_type) && ply_type(words[3], p.type);
+                }
+                else if (words.size() == 3)
+                {
+                    p.name = words[2];
+                    ok = ply_type(words[1], p.type);
+                }
+                if (!ok)
+                {
+                    header.error = "malformed property";
+                    return false;
+                }
+                header.elements.back().properties.push_back(p);
+            }
+            else
+            {
+                header.error = "unexpected '" + words[0] + "'";
+                return false;
+            }
+        }
+        header.error = "no end_header";
+        return false;
+    }
+
+    // Where the vertex element keeps x y z and the face element its index list
+    struct PlyLayout
+    {
+        int xyz[3] = { -1, -1, -1 };
+        int indices = -1;
+    };
+
+    bool load_ply_ascii(const char* filename, const MappedFile& file, const PlyHeader& header, const PlyLayout& layout, TriangleMesh& mesh)
+    {
+        const char* p = reinterpret_cast<const char*>(file.data()) + header.data_start;
+        const char* end = reinterpret_cast<const char*>(file.data()) + file.size();
+        auto next = [&](double& v) {
+            while (p < end && (is_space(*p) || *p == '\n')) ++p;
+            return parse_number(p, end, v);
+        };
+
+        std::vector<uint32_t> polygon;
+        for (const PlyElement& e : header.elements)
+        {
+            bool is_vertex = e.name == "vertex", is_face = e.name == "face";
+            for (size_t i = 0; i < e.count; ++i)
+            {
+                float xyz[3]{};
+                for (size_t k = 0; k < e.properties.size(); ++k)
+                {
+                    const PlyProperty& prop = e.properties[k];
+                    double v;
+                    if (!next(v))
+                    {
+                        std::cerr << "Error: " << filename << ": malformed or missing " << e.name << " " << i << std::endl;
+                        return false;
+                    }
+                    if (!prop.is_list)
+                    {
+                        if (is_vertex)
+                            for (int a = 0; a < 3; ++a)
+                                if (int(k) == layout.xyz[a]) xyz[a] = float(v);
+                        continue;
+                    }
+
+                    size_t n = size_t(v);
+                    bool collect = is_face && int(k) == layout.indices;
+                    polygon.clear();
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        double index;
+                        if (!next(index))
+                        {
+                            std::cerr << "Error: " << filename << ": malformed or missing " << e.name << " " << i << std::endl;
+                            return false;
+                        }
+                        if (collect)
+                            polygon.push_back(index >= 0 && index < 4294967296.0 ? uint32_t(index) : UINT32_MAX);
+                    }
+                    if (collect)
+                        add_fan(polygon, mesh.indices);
+                }
+                if (is_vertex)
+                    mesh.positions.insert(mesh.positions.end(), xyz, xyz + 3);
+            }
+        }
+        return true;
+    }
+
+    bool load_ply_binary(const char* filename, const MappedFile& file, const PlyHeader& header, const PlyLayout& layout, ThreadPool& pool, TriangleMesh& mesh)
+    {
+        const uint8_t* data = file.data();
+        size_t size = file.size(), pos = header.data_start;
+        bool swap = header.format == PlyFormat::BigEndian;
+        auto truncated = [&]() {
+            std::cerr << "Error: " << filename << " is truncated" << std::endl;
+            return false;
+        };
+
+        std::vector<uint32_t> polygon;
+        for (const PlyElement& e : header.elements)
+        {
+            bool is_vertex = e.name == "vertex", is_face = e.name == "face";
+
+            // Fixed size items: vertices are converted a block of items per task
+            if (size_t stride = e.stride())
+            {
+                if ((size - pos) / stride < e.count) return truncated();
+                if (is_vertex)
+                {
+                    size_t offsets[3]{};
+                    PlyType types[3]{};
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        int k = layout.xyz[a];
+                        types[a] = e.properties[k].type;
+                        for (int j = 0; j < k; ++j)
+                            offsets[a] += ply_size(e.properties[j].type);
+                    }
+                    mesh.positions.resize(e.count * 3);
+                    const uint8_t* items = data + pos;
+                    pool.parallel_for((e.count + items_per_task - 1) / items_per_task, [&](size_t task, unsigned) {
+                        size_t last = std::min(e.count, (task + 1) * items_per_task);
+                        for (size_t i = task * items_per_task; i < last; ++i)
+                            for (int a = 0; a < 3; ++a)
+                                mesh.positions[3 * i + a] = float(read_value(items + i * stride + offsets[a], types[a], swap));
+                    });
+                }
+                pos += e.count * stride;
+                continue;
+            }
+
+            // Faces that are nothing but a triangle list fill the rest of the file with items of one size, every
+            // count of which must then say 3. Converted on the pool like the vertices
+            if (is_face && e.properties.size() == 1 && &e == &header.elements.back())
+            {
+                const PlyProperty& prop = e.properties[0];
+                size_t count_size = ply_size(prop.count_type), index_size = ply_size(prop.type);
+                size_t stride = count_size + 3 * index_size;
+                if (e.count && (size - pos) / stride == e.count && (size - pos) % stride == 0)
+                {
+                    const uint8_t* items = data + pos;
+                    size_t tasks = (e.count + items_per_task - 1) / items_per_task;
+                    std::vector<uint8_t> not_triangles(tasks);
+                    std::vector<uint32_t> indices(e.count * 3);
+                    pool.parallel_for(tasks, [&](size_t task, unsigned) {
+                        size_t last = std::min(e.count, (task + 1) * items_per_task);
+                        for (size_t i = task * items_per_task; i < last; ++i)
+                        {
+                            const uint8_t* item = items + i * stride;
+                            not_triangles[task] |= read_value(item, prop.count_type, swap) != 3;
+                            for (int k = 0; k < 3; ++k)
+                            {
+                                double index = read_value(item + count_size + k * index_size, prop.type, swap);
+                                indices[3 * i + k] = index >= 0 ? uint32_t(index) : UINT32_MAX;
+                            }
+                        }
+                    });
+                    if (std::find(not_triangles.begin(), not_triangles.end(), uint8_t(1)) == not_triangles.end())
+                    {
+                        mesh.indices = std::move(indices);
+                        pos = size;
+                        continue;
+                    }
+                }
+            }
+
+            // Anything else, one item after the other
+            for (size_t i = 0; i < e.count; ++i)
+            {
+                float xyz[3]{};
+                for (size_t k = 0; k < e.properties.size(); ++k)
+                {
+                    const PlyProperty& prop = e.properties[k];
+                    if (!prop.is_list)
+                    {
+                        if (size - pos < ply_size(prop.type)) return truncated();
+                        if (is_vertex)
+                            for (int a = 0; a < 3; ++a)
+                                if (int(k) == layout.xyz[a]) xyz[a] = float(read_value(data + pos, prop.type, swap));
+                        pos += ply_size(prop.type);
+                        continue;
+                    }
+
+                    if (size - pos < ply_size(prop.count_type)) return truncated();
+                    double items = read_value(data + pos, prop.count_type, swap);
+                    pos += ply_size(prop.count_type);
+                    size_t n = items > 0 ? size_t(items) : 0, index_size = ply_size(prop.type);
+                    if ((size - pos) / index_size < n) return truncated();
+                    if (is_face && int(k) == layout.indices)
+                    {
+                        polygon.clear();
+                        for (size_t j = 0; j < n; ++j)
+                        {
+                            double index = read_value(data + pos + j * index_size, prop.type, swap);
+                            polygon.push_back(index >= 0 ? uint32_t(index) : UINT32_MAX);
+                        }
+                        add_fan(polygon, mesh.indices);
+                    }
+                    pos += n * index_size;
+                }
+                if (is_vertex)
+                    mesh.positions.insert(mesh.positions.end(), xyz, xyz + 3);
+            }
+        }
+        return true;
+    }
+
+    bool load_ply(const char* filename, const MappedFile& file, ThreadPool& pool, TriangleMesh& mesh)
+    {
+        PlyHeader header;
+        if (!parse_ply_header(file, header))
+        {
+            std::cerr << "Error: " << filename << ":" << header.lines << ": " << header.error << std::endl;
+            return false;
+        }
+
+        PlyLayout layout;
+        for (const PlyElement& e : header.elements)
+        {
+            if (e.name == "vertex")
+            {
+                layout.xyz[0] = e.find("x");
+                layout.xyz[1] = e.find("y");
+                layout.xyz[2] = e.find("z");
+            }
+            else if (e.name == "face")
+            {
+                layout.indices = e.find("vertex_indices");
+                if (layout.indices < 0)
+                    layout.indices = e.find("vertex_index");
+            }
+        }
+        if (layout.xyz[0] < 0 || layout.xyz[1] < 0 || layout.xyz[2] < 0 || layout.indices < 0)
+        {
+            std::cerr << "Error: " << filename << " needs a vertex element with x y z and a face element with vertex_indices" << std::endl;
+            return false;
+        }
+
+        bool ok = header.format == PlyFormat::Ascii ? load_ply_ascii(filename, file, header, layout, mesh)
+            : load_ply_binary(filename, file, header, layout, pool, mesh);
+        if (!ok) return false;
+
+        size_t vertices = mesh.vertex_count();
+        if (std::any_of(mesh.indices.begin(), mesh.indices.end(), [&](uint32_t v) { return v >= vertices; }))
+        {
+            std::cerr << "Error: " << filename << ": a face refers to a vertex that does not exist" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool has_extension(const char* filename, const char* extension)
+    {
+        size_t len = std::strlen(filename), ext = std::strlen(extension);
+        if (len < ext) return false;
+        for (size_t i = 0; i < ext; ++i)
+            if (std::tolower(static_cast<unsigned char>(filename[len - ext + i])) != extension[i]) return false;
+        return true;
+    }
+}
+
+bool load_mesh(const char* filename, ThreadPool& pool, TriangleMesh& mesh)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    mesh.positions.clear();
+    mesh.indices.clear();
+
+    bool obj = has_extension(filename, ".obj");
+    if (!obj && !has_extension(filename, ".ply"))
+    {
+        std::cerr << "Error: " << filename << " is neither .obj nor .ply" << std::endl;
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(filename))
+    {
+        std::cerr << "Error: can not open the mesh " << filename << std::endl;
+        return false;
+    }
+
+    if (!(obj ? load_obj(filename, file, pool, mesh) : load_ply(filename, file, pool, mesh)))
+        return false;
+    std::cout << "Mesh: " << filename << ", " << mesh.vertex_count() << " vertices, " << mesh.triangle_count() << " triangles, loaded in "
+        << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+    return true;
+}
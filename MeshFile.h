@@ -0,0 +1,18 @@
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+class TriangleMesh;
+class ThreadPool;
+
+// Triangle mesh files, picked by the extension:
+//   .obj  'v' and 'f' records. Polygons are split into fans, negative (relative) indices are allowed and
+//         everything else (normals, texture coordinates, groups, materials) is skipped. The text is cut into
+//         chunks at line ends that are parsed on the thread pool side by side, like a text scene.
+//   .ply  ascii, binary_little_endian or binary_big_endian with a 'vertex' element that has x y z and a 'face'
+//         element with a vertex_indices list, in any property types. Other elements and properties are skipped.
+//         Binary vertices, and binary faces when they are all triangles, are converted on the thread pool.
+// Fills the vertex and index buffers of 'mesh' and nothing else, TriangleMesh::build() is up to the caller.
+// Errors are printed and leave false.
+bool load_mesh(const char* filename, ThreadPool& pool, TriangleMesh& mesh);
+
+#endif
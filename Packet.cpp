@@ -0,0 +1,179 @@
+// Packet.cpp : BVH traversal of a whole RayPacket at once, the rays of the packet sit in SIMD lanes
+//
+
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include "RayTracer.h"
+#include "Packet.h"
+#include "Stats.h"
+
+namespace
+{
+    // Minimal SIMD float wrapper, same instruction set selection as SphereSoA
+#if defined(RT_SPHERE_AVX)
+    struct vfloat
+    {
+        static constexpr int width = 8;
+        __m256 v;
+
+        static vfloat load(const float* p) { return { _mm256_load_ps(p) }; }
+        static vfloat set1(float f) { return { _mm256_set1_ps(f) }; }
+        static vfloat bits(int32_t i) { return { _mm256_castsi256_ps(_mm256_set1_epi32(i)) }; }
+        void store(float* p) const { _mm256_store_ps(p, v); }
+        friend vfloat operator+(vfloat a, vfloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+        friend vfloat operator-(vfloat a, vfloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+        friend vfloat operator*(vfloat a, vfloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+        friend vfloat operator&(vfloat a, vfloat b) { return { _mm256_and_ps(a.v, b.v) }; }
+        friend vfloat vmin(vfloat a, vfloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+        friend vfloat vmax(vfloat a, vfloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+        friend vfloat vsqrt(vfloat a) { return { _mm256_sqrt_ps(a.v) }; }
+        friend vfloat operator<(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+        friend vfloat operator>=(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+        friend vfloat select(vfloat mask, vfloat a, vfloat b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+        friend int movemask(vfloat a) { return _mm256_movemask_ps(a.v); }
+    };
+#elif defined(RT_SPHERE_SSE)
+    struct vfloat
+    {
+        static constexpr int width = 4;
+        __m128 v;
+
+        static vfloat load(const float* p) { return { _mm_load_ps(p) }; }
+        static vfloat set1(float f) { return { _mm_set1_ps(f) }; }
+        static vfloat bits(int32_t i) { return { _mm_castsi128_ps(_mm_set1_epi32(i)) }; }
+        void store(float* p) const { _mm_store_ps(p, v); }
+        friend vfloat operator+(vfloat a, vfloat b) { return { _mm_add_ps(a.v, b.v) }; }
+        friend vfloat operator-(vfloat a, vfloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+        friend vfloat operator*(vfloat a, vfloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+        friend vfloat operator&(vfloat a, vfloat b) { return { _mm_and_ps(a.v, b.v) }; }
+        friend vfloat vmin(vfloat a, vfloat b) { return { _mm_min_ps(a.v, b.v) }; }
+        friend vfloat vmax(vfloat a, vfloat b) { return { _mm_max_ps(a.v, b.v) }; }
+        friend vfloat vsqrt(vfloat a) { return { _mm_sqrt_ps(a.v) }; }
+        friend vfloat operator<(vfloat a, vfloat b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+        friend vfloat operator>=(vfloat a, vfloat b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+        friend vfloat select(vfloat mask, vfloat a, vfloat b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+        friend int movemask(vfloat a) { return _mm_movemask_ps(a.v); }
+    };
+#else
+    struct vfloat
+    {
+        static constexpr int width = 1;
+        float v;
+
+        static vfloat load(const float* p) { return { *p }; }
+        static vfloat set1(float f) { return { f }; }
+        static vfloat bits(int32_t i) { vfloat r; std::memcpy(&r.v, &i, sizeof(float)); return r; }
+        void store(float* p) const { *p = v; }
+        friend vfloat operator+(vfloat a, vfloat b) { return { a.v + b.v }; }
+        friend vfloat operator-(vfloat a, vfloat b) { return { a.v - b.v }; }
+        friend vfloat operator*(vfloat a, vfloat b) { return { a.v * b.v }; }
+        friend vfloat operator&(vfloat a, vfloat b) { return { (a.v != 0.f && b.v != 0.f) ? 1.f : 0.f }; }
+        friend vfloat vmin(vfloat a, vfloat b) { return { b.v < a.v ? b.v : a.v }; }
+        friend vfloat vmax(vfloat a, vfloat b) { return { a.v < b.v ? b.v : a.v }; }
+        friend vfloat vsqrt(vfloat a) { return { std::sqrt(a.v) }; }
+        friend vfloat operator<(vfloat a, vfloat b) { return { a.v < b.v ? 1.f : 0.f }; }
+        friend vfloat operator>=(vfloat a, vfloat b) { return { a.v >= b.v ? 1.f : 0.f }; }
+        friend vfloat select(vfloat mask, vfloat a, vfloat b) { return mask.v != 0.f ? a : b; }
+        friend int movemask(vfloat a) { return a.v != 0.f; }
+    };
+#endif
+
+    constexpr int groups = RayPacket::size / vfloat::width;
+}
+
+void packet_closest_hit(RayPacket& packet, const Scene& scene)
+{
+    RT_STAT_TIME(Intersect);
+    // Inactive rays get t = 0, which no box or sphere test can beat
+    alignas(32) float inv_x[RayPacket::size], inv_y[RayPacket::size], inv_z[RayPacket::size];
+    for (int r = 0; r < RayPacket::size; ++r)
+    {
+        bool active = (packet.active >> r) & 1;
+        if (!active) { packet.dx[r] = 0.f; packet.dy[r] = 0.f; packet.dz[r] = -1.f; }
+        inv_x[r] = 1.f / packet.dx[r];
+        inv_y[r] = 1.f / packet.dy[r];
+        inv_z[r] = 1.f / packet.dz[r];
+        packet.t[r] = active ? std::numeric_limits<float>::max() : 0.f;
+        packet.sphere[r] = -1;
+    }
+
+    const BVH& bvh = scene.bvh;
+    const SphereSoA& soa = scene.sphere_soa;
+    if (bvh.empty() || !packet.active) return;
+
+    // Child order is decided by the first active ray, the packet is coherent enough for that to suit all of them
+    int lead = 0;
+    while (!((packet.active >> lead) & 1)) ++lead;
+    int dir_neg[3] = { packet.dx[lead] < 0, packet.dy[lead] < 0, packet.dz[lead] < 0 };
+
+    const vfloat zero = vfloat::set1(0.f);
+    uint32_t stack[64];
+    int sp = 0;
+    uint32_t current = 0;
+    while (true)
+    {
+        const BVHNode& node = bvh.nodes[current];
+
+        // Does any ray of the packet reach this node before its current closest hit?
+        bool reached = false;
+        for (int g = 0; g < groups && !reached; ++g)
+        {
+            int o = g * vfloat::width;
+            vfloat ox = vfloat::load(packet.ox + o), oy = vfloat::load(packet.oy + o), oz = vfloat::load(packet.oz + o);
+            vfloat ix = vfloat::load(inv_x + o), iy = vfloat::load(inv_y + o), iz = vfloat::load(inv_z + o);
+            vfloat tx1 = (vfloat::set1(node.lo[0]) - ox) * ix, tx2 = (vfloat::set1(node.hi[0]) - ox) * ix;
+            vfloat ty1 = (vfloat::set1(node.lo[1]) - oy) * iy, ty2 = (vfloat::set1(node.hi[1]) - oy) * iy;
+            vfloat tz1 = (vfloat::set1(node.lo[2]) - oz) * iz, tz2 = (vfloat::set1(node.hi[2]) - oz) * iz;
+            vfloat t_near = vmax(vmax(vmin(tx1, tx2), vmin(ty1, ty2)), vmin(tz1, tz2));
+            vfloat t_far = vmin(vmin(vmax(tx1, tx2), vmax(ty1, ty2)), vmax(tz1, tz2));
+            reached = movemask((t_far >= vmax(t_near, zero)) & (t_near < vfloat::load(packet.t + o))) != 0;
+        }
+
+        if (reached)
+        {
+            if (node.is_leaf())
+            {
+                for (uint32_t k = node.offset; k < node.offset + node.count; ++k)
+                {
+                    vfloat cx = vfloat::set1(soa.cx[k]), cy = vfloat::set1(soa.cy[k]), cz = vfloat::set1(soa.cz[k]);
+                    vfloat r2 = vfloat::set1(soa.radius[k] * soa.radius[k]);
+                    vfloat id = vfloat::bits(int32_t(k));
+                    for (int g = 0; g < groups; ++g)
+                    {
+                        int o = g * vfloat::width;
+                        vfloat vx = cx - vfloat::load(packet.ox + o), vy = cy - vfloat::load(packet.oy + o), vz = cz - vfloat::load(packet.oz + o);
+                        vfloat c_proj = vx * vfloat::load(packet.dx + o) + vy * vfloat::load(packet.dy + o) + vz * vfloat::load(packet.dz + o);
+                        vfloat h2 = r2 - ((vx * vx + vy * vy + vz * vz) - c_proj * c_proj);
+                        vfloat dist = vsqrt(vmax(h2, zero));
+                        vfloat t_near = c_proj - dist;
+                        vfloat t = select(t_near < zero, c_proj + dist, t_near);
+
+                        vfloat t_cur = vfloat::load(packet.t + o);
+                        vfloat closer = (h2 >= zero) & (t >= zero) & (t < t_cur);
+                        if (!movemask(closer)) continue;
+                        select(closer, t, t_cur).store(packet.t + o);
+                        float* ids = reinterpret_cast<float*>(packet.sphere + o);
+                        select(closer, id, vfloat::load(ids)).store(ids);
+                    }
+                }
+            }
+            else
+            {
+                if (dir_neg[node.axis])
+                {
+                    stack[sp++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[sp++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) break;
+        current = stack[--sp];
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <cstdint>
+#include "Geometry.h"
+
+struct Scene;
+
+// 4x4 block of coherent primary rays stored as structure of arrays, traced through the BVH together.
+// Only the closest sphere is found here, the rays are then resolved and shaded one by one, so secondary
+// rays (which diverge after reflection and refraction) keep using the single ray path.
+struct RayPacket
+{
+	static constexpr int width = 4, height = 4, size = width * height;
+
+	alignas(32) float ox[size], oy[size], oz[size];
+	alignas(32) float dx[size], dy[size], dz[size];
+	alignas(32) float t[size];			// closest sphere distance, max float when nothing was hit
+	alignas(32) int32_t sphere[size];	// SoA index of the closest sphere, -1 when nothing was hit
+	uint32_t active{};					// bit per ray, blocks on the frame border leave some rays out
+
+	void set(int lane, const Vec3f& orig, const Vec3f& dir)
+	{
+		ox[lane] = orig.x; oy[lane] = orig.y; oz[lane] = orig.z;
+		dx[lane] = dir.x; dy[lane] = dir.y; dz[lane] = dir.z;
+		active |= 1u << lane;
+	}
+
+	Vec3f orig(int lane) const { return Vec3f(ox[lane], oy[lane], oz[lane]); }
+	Vec3f dir(int lane) const { return Vec3f(dx[lane], dy[lane], dz[lane]); }
+};
+
+// Fills packet.t and packet.sphere for every active ray, same result as the single ray traversal
+void packet_closest_hit(RayPacket& packet, const Scene& scene);
+
+#endif
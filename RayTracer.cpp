@@ -5,122 +5,585 @@
 #include <vector>
 #include <fstream>
 #include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <random>
 #include "Geometry.h"
 #include "RayTracer.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
-int envmap_width, envmap_height;
-std::vector<Vec3f> envmap;
-
-int main()
+#include "ImageWriter.h"
+#include "RenderSettings.h"
+#include "SceneFile.h"
+#include "Bench.h"
+#include "Stats.h"
+#include "Dependencies.h"
+
+EnvMap envmap;
+Termination ray_termination = default_termination;
+float min_contribution = default_min_contribution;
+
+int main(int argc, char** argv)
 {
-    // Step0. Read an image from disk
-    int n = -1;
-    unsigned char* pixmap = stbi_load("envmap.jpg", &envmap_width, &envmap_height, &n, 0);
-    if (!pixmap || 3 != n) {
-        std::cerr << "Error: can not load the environment map" << std::endl;
+    RenderSettings settings;
+    if (!settings.parse(argc, argv))
         return -1;
+    ThreadPool pool(settings.threads);
+    ray_termination = settings.termination;
+    min_contribution = settings.min_contribution;
+
+    // Step0. Load the scene, or put the demo scene together
+    Scene scene;
+    if (!settings.scene.empty())
+    {
+        if (!load_scene(settings.scene.c_str(), pool, scene))
+            return -1;
     }
-    envmap = std::vector<Vec3f>(envmap_width * envmap_height);
-    for (int j = envmap_height - 1; j >= 0; j--) {
-        for (int i = 0; i < envmap_width; i++) {
-            envmap[i + j * envmap_width] = Vec3f(pixmap[(i + j * envmap_width) * 3 + 0], pixmap[(i + j * envmap_width) * 3 + 1], pixmap[(i + j * envmap_width) * 3 + 2]) * (1 / 255.);
-        }
+    else
+        demo_scene(scene);
+    if (!settings.save_scene.empty() && !save_scene(settings.save_scene.c_str(), scene))
+        return -1;
+    if (settings.fov <= 0)
+        settings.fov = scene.fov;
+
+    // Step1. Read an image from disk
+    if (!envmap.load(scene.envmap.c_str(), pool, settings.envmap_cache))
+        return -1;
+
+    if (settings.bench)
+        return run_benchmarks(settings, pool) ? 0 : -1;
+
+    // Step2. Build the acceleration structure over the spheres
+    scene.build_bvh();
+    Camera camera(settings.width, settings.height, settings.fov, scene.eye);
+    if (settings.report)
+    {
+        report_envmap(envmap);
+        report_bvh(scene, camera);
+        report_packets(scene, camera);
+        report_wavefront(scene, camera);
+        report_incremental(scene, camera, pool);
     }
-    stbi_image_free(pixmap);
 
-    // Step1. Write an image to the disk
-    std::vector<Material> materials;
+    // Step3. Render the frame, or every frame of the animation, on all cores
+    Framebuffer frame;
+    if (scene.frames > 1)
+        render_animation(scene, pool, frame, settings);
+    else
+        render(scene, pool, frame, settings);
+    return 0;
+}
+
+// The scene this program was written around, what runs without --scene. demo.scene is the same as a file
+void demo_scene(Scene& scene)
+{
+    std::vector<Material>& materials = scene.materials;
     materials.push_back(Material(Vec4f(0.6f,0.1f,0.1f,0.0f), Vec3f(0.4f, 0.4f, 0.3f), 50.f, 1.0f));
     materials.push_back(Material(Vec4f(0.9f,0.1f,0.0f,0.0f), Vec3f(0.3f, 0.1f, 0.1f), 10.f, 1.0f));
     materials.push_back(Material(Vec4f(0.0f, 10.0f,0.8f, 0.0f), Vec3f(1.0f, 1.0f, 1.0f), 1425.f, 1.0f));
     materials.push_back(Material(Vec4f(0.0f, 0.5f, 0.1f, 0.8f), Vec3f(0.6f, 0.7f, 0.8f), 125.0f, 1.5f));
 
-    std::vector<std::unique_ptr<Sphere>> spheres;
-    spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(-3, 0, -16), 2, materials[0])));  // const L-value can be assigned R-value
-    spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(-1.0, -1.5, -12), 2, materials[3])));
-    spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(1.5, -0.5, -18), 3, materials[1])));
-    spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(7, 5, -18), 4, materials[2])));
+    scene.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(-3, 0, -16), 2, 0)));  // const L-value can be assigned R-value
+    scene.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(-1.0, -1.5, -12), 2, 3)));
+    scene.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(1.5, -0.5, -18), 3, 1)));
+    scene.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(7, 5, -18), 4, 2)));
 
-    // Step2. Define the position of light;
+    // Define the position of light;
 
-    std::vector<std::unique_ptr<Light>> lights;
-    //lights.push_back(std::make_unique<Light>((Light(Vec3f(-25.f, 0.f, -40.f), 30.f))));
+    //scene.lights.push_back(std::make_unique<Light>((Light(Vec3f(-25.f, 0.f, -40.f), 30.f))));
     
-    lights.push_back(std::make_unique<Light>(Light(Vec3f(-20, 20,  20), 1.5)));
-    lights.push_back(std::make_unique<Light>(Light(Vec3f( 30, 50, -25), 1.8)));
-    lights.push_back(std::make_unique<Light>(Light(Vec3f( 30, 20,  30), 1.7)));
+    scene.lights.push_back(std::make_unique<Light>(Light(Vec3f(-20, 20,  20), 1.5)));
+    scene.lights.push_back(std::make_unique<Light>(Light(Vec3f( 30, 50, -25), 1.8)));
+    scene.lights.push_back(std::make_unique<Light>(Light(Vec3f( 30, 20,  30), 1.7)));
 
-    render(spheres, lights);
-    return 0;
+    // The checkerboard, a box with no height and no material
+    scene.shapes.push_back(Shape::box(Vec3f(-10, -4, -30), Vec3f(10, -4, -10), Scene::no_material, Texture::checker(Vec3f(1, 1, 1), Vec3f(1, .7, .3))));
 }
 
-void render(const std::vector<std::unique_ptr<Sphere>>& spheres, const std::vector<std::unique_ptr<Light>>& lit)
+void render(const Scene& scene, ThreadPool& pool, Framebuffer& frame, const RenderSettings& settings)
 {
-    std::vector<std::unique_ptr<Vec3f>> pixelInfo((w_height * w_width));
+    // The common sizes get a camera with the resolution built in, anything else takes the runtime one
+    if (settings.width == w_width && settings.height == w_height)
+        render_progressive(scene, FixedCamera<w_width, w_height>(settings.fov, scene.eye), pool, frame, settings);
+    else if (settings.width == 1920 && settings.height == 1080)
+        render_progressive(scene, FixedCamera<1920, 1080>(settings.fov, scene.eye), pool, frame, settings);
+    else if (settings.width == 3840 && settings.height == 2160)
+        render_progressive(scene, FixedCamera<3840, 2160>(settings.fov, scene.eye), pool, frame, settings);
+    else
+        render_progressive(scene, Camera(settings.width, settings.height, settings.fov, scene.eye), pool, frame, settings);
+}
+
+// Renders every frame of the scene's animation into its own file, the output name with the frame number before
+// the extension ("Raytracer_0007.ppm"). The pool, envmap, framebuffer and BVH stay alive from frame to frame,
+// the BVH is refit to the spheres that moved and only rebuilt when that made it too slow. Moving instances only
+// rebuilds the top level over them, the meshes' own BVHs are never touched
+void render_animation(Scene& scene, ThreadPool& pool, Framebuffer& frame, const RenderSettings& settings)
+{
+    RenderSettings frame_settings = settings;
+    size_t slash = settings.out.find_last_of("/\\"), dot = settings.out.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = settings.out.size();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    double update_ms = 0;
+    int refits = 0, rebuilds = 0, top_builds = 0;
+    for (int f = 0; f < scene.frames; ++f)
+    {
+        auto update_start = std::chrono::high_resolution_clock::now();
+        Scene::Moved moved = scene.animate(f);
+        if (moved.spheres)
+            ++(scene.update_bvh() ? rebuilds : refits);
+        if (moved.instances)
+        {
+            scene.build_instance_bvh();
+            ++top_builds;
+        }
+        update_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - update_start).count();
+
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%04d", f);
+        frame_settings.out = settings.out.substr(0, dot) + number + settings.out.substr(dot);
+        std::cout << "Frame " << f + 1 << " of " << scene.frames << "\n";
+        render(scene, pool, frame, frame_settings);
+    }
+
+    double total_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Animation: " << scene.frames << " frames in " << total_s << " s, " << 60 * scene.frames / total_s << " frames per minute, "
+        << refits << " BVH refits, " << rebuilds << " rebuilds and " << top_builds << " instance BVH builds in " << update_ms << " ms" << std::endl;
+}
+
+// Renders passes of settings.pass_spp samples per pixel into the frame, which always holds the mean of the samples
+// so far, until the sample budget is spent or the next pass would go over the time budget. Every settings.progress
+// passes the image so far is written to the output file.
+// With settings.noise set the sampling is adaptive: once a tile has settings.min_spp samples it leaves the passes
+// as soon as the standard error of every one of its pixels is below settings.noise, so the samples go to the glass
+// and the edges while the flat parts stop early
+template <class Cam>
+void render_progressive(const Scene& scene, const Cam& camera, ThreadPool& pool, Framebuffer& frame, const RenderSettings& settings)
+{
+    // Counts from the reports before the frame are dropped
+    RT_STAT_RESET();
+
+    const bool adaptive = settings.noise > 0;
+    const int tiles_x = (camera.width() + tile_size - 1) / tile_size;
+    const int tiles_y = (camera.height() + tile_size - 1) / tile_size;
+    std::vector<uint32_t> active(tiles_x * tiles_y);		// tiles still in the passes
+    std::vector<int> tile_samples(active.size());			// samples a tile had when it left
+    for (size_t t = 0; t < active.size(); ++t)
+        active[t] = uint32_t(t);
+    frame.resize(camera.width(), camera.height());
+    if (adaptive)
+        frame.track_variance();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<TileStats> tiles;
+    int samples = 0, passes = 0;
+    double elapsed_s = 0, pass_s = 0;
+    while ((settings.spp == 0 || samples < settings.spp) && !active.empty())
+    {
+        int count = settings.spp ? std::min(settings.pass_spp, settings.spp - samples) : settings.pass_spp;
+        std::vector<TileStats> pass = render_frame(scene, camera, pool, frame, samples, count, adaptive ? &active : nullptr);
+        samples += count;
+        ++passes;
+
+        if (adaptive && passes >= 2 && samples >= settings.min_spp)
+        {
+            // Largest standard error of a tile's pixels, in 8 bit levels
+            std::vector<uint8_t> done(active.size());
+            pool.parallel_for(active.size(), [&](size_t k, unsigned) {
+                const TileStats& t = pass[active[k]];
+                int x1 = std::min(t.x0 + tile_size, camera.width()), y1 = std::min(t.y0 + tile_size, camera.height());
+                float worst = 0;
+                for (int y = t.y0; y < y1; ++y)
+                    for (int x = t.x0; x < x1; ++x)
+                        worst = std::max(worst, frame.standard_error(x, y, passes, samples));
+                done[k] = worst * 255 <= settings.noise;
+            });
+
+            size_t kept = 0;
+            for (size_t k = 0; k < active.size(); ++k)
+            {
+                if (done[k])
+                    tile_samples[active[k]] = samples;
+                else
+                    active[kept++] = active[k];
+            }
+            active.resize(kept);
+        }
+
+        // Tile times add up over the passes, the tiles are the same every pass
+        if (tiles.empty())
+            tiles = pass;
+        else
+            for (size_t t = 0; t < tiles.size(); ++t)
+                tiles[t].ms += pass[t].ms;
+
+        double now_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        pass_s = now_s - elapsed_s;
+        elapsed_s = now_s;
+        if (settings.time > 0 && elapsed_s + pass_s > settings.time)
+            break;
+        if (settings.progress > 0 && passes % settings.progress == 0 && (settings.spp == 0 || samples < settings.spp))
+        {
+            std::cout << "Pass " << passes << ": " << samples << " samples per pixel in " << elapsed_s << " s\n";
+            write_to_file(settings.out.c_str(), frame, pool);
+        }
+    }
+
+    if (passes > 1)
+        std::cout << "Rendered " << samples << " samples per pixel in " << passes << " passes, " << elapsed_s << " s\n";
+    if (adaptive)
+    {
+        // Per pixel, the border tiles are smaller
+        double total = 0;
+        for (uint32_t t : active)
+            tile_samples[t] = samples;
+        for (const TileStats& t : tiles)
+        {
+            int w = std::min(tile_size, camera.width() - t.x0), h = std::min(tile_size, camera.height() - t.y0);
+            total += double(tile_samples[t.y0 / tile_size * tiles_x + t.x0 / tile_size]) * w * h;
+        }
+        double mean = total / (double(camera.width()) * camera.height());
+        std::cout << "Adaptive: " << tiles.size() - active.size() << " of " << tiles.size() << " tiles below noise " << settings.noise
+            << ", mean " << mean << " samples per pixel, " << 100. * mean / samples << "% of a fixed " << samples << "\n";
+    }
+    report_tiles(tiles, pool);
+    RT_STAT_REPORT(tiles);
+    write_to_file(settings.out.c_str(), frame, pool);
+}
+
+// Renders samples first .. first + count - 1 of every pixel tile by tile on the pool, folds them into the frame
+// (see Framebuffer::add_samples) and returns how long every tile took. With 'active' only the tiles listed there
+// are rendered, the others keep their pixels and take 0 ms. With 'deps' what every rendered tile depended on is
+// recorded there, for re-rendering only the tiles an edit touches
+template <class Cam>
+std::vector<TileStats> render_frame(const Scene& scene, const Cam& camera, ThreadPool& pool, Framebuffer& frame, int first, int count,
+    const std::vector<uint32_t>* active, TileDependencies* deps)
+{
+    // No allocation when the frame is reused at the same size
+    frame.resize(camera.width(), camera.height());
 
     // Code to populate background color in image 
     /*for (size_t i = 0; i < w_width; ++i)
     {
         for (size_t j = 0; j < w_height; ++j)
         {
-            pixelInfo[i + j * w_width] = Vec3f(j / (float)w_height, i / (float)w_width, 0);
+            frame.set(i, j, Vec3f(j / (float)w_height, i / (float)w_width, 0));
         }
     }*/
 
-#pragma omp parallel for
-    for (size_t i = 0; i < w_width; ++i)
+    // Square tiles keep the rays of a task coherent, and rows inside a tile are written contiguously
+    const int tiles_x = (camera.width() + tile_size - 1) / tile_size;
+    const int tiles_y = (camera.height() + tile_size - 1) / tile_size;
+    std::vector<TileStats> tiles(tiles_x * tiles_y);
+    for (size_t tile = 0; tile < tiles.size(); ++tile)
+        tiles[tile] = TileStats{ int(tile % tiles_x) * tile_size, int(tile / tiles_x) * tile_size };
+    std::vector<Wavefront> engines(pool.size());
+    std::vector<TileDependencies::Recorder> recorders(deps ? pool.size() : 0);
+    if (deps && deps->size() != tiles.size())
+        deps->reset(tiles.size());
+
+    pool.parallel_for(active ? active->size() : tiles.size(), [&](size_t task, unsigned worker) {
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t tile = active ? (*active)[task] : task;
+        int x0 = tiles[tile].x0, y0 = tiles[tile].y0;
+        int x1 = std::min(x0 + tile_size, camera.width()), y1 = std::min(y0 + tile_size, camera.height());
+
+        if (deps)
+            deps->begin_tile(recorders[worker]);
+        if (render_engine == Engine::Wavefront)
+            engines[worker].render_tile(scene, camera, x0, y0, x1, y1, first, count, frame);
+        else
+            render_tile_recursive(scene, camera, x0, y0, x1, y1, first, count, frame);
+        if (deps)
+            deps->end_tile(tile, recorders[worker]);
+
+        tiles[tile] = TileStats{ x0, y0, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count(), worker };
+    });
+
+    return tiles;
+}
+
+template std::vector<TileStats> render_frame<Camera>(const Scene&, const Camera&, ThreadPool&, Framebuffer&, int, int, const std::vector<uint32_t>*, TileDependencies*);
+
+// One cast_ray per sample, primary rays still go through 4x4 packets when use_packets is on
+template <class Cam>
+void render_tile_recursive(const Scene& scene, const Cam& camera, int x0, int y0, int x1, int y1, int first, int count, Framebuffer& frame)
+{
+    if (use_packets)
     {
-        for (size_t j = 0; j < w_height; ++j)
+        // Trace each 4x4 block of primary rays as one packet per sample, then shade its pixels one by one
+        RayPacket packet;
+        Vec3f sums[RayPacket::size];
+        for (int by = y0; by < y1; by += RayPacket::height)
+        {
+            for (int bx = x0; bx < x1; bx += RayPacket::width)
+            {
+                std::fill(sums, sums + RayPacket::size, Vec3f(0.f, 0.f, 0.f));
+                for (int s = first; s < first + count; ++s)
+                {
+                    packet.active = 0;
+                    for (int r = 0; r < RayPacket::size; ++r)
+                    {
+                        int i = bx + r % RayPacket::width, j = by + r / RayPacket::width;
+                        packet.set(r, camera.origin(), i < x1 && j < y1 ? camera.dir(i, j, s) : Vec3f(0.f, 0.f, -1.f));
+                        if (i >= x1 || j >= y1) packet.active &= ~(1u << r);
+                    }
+                    packet_closest_hit(packet, scene);
+
+                    for (int r = 0; r < RayPacket::size; ++r)
+                    {
+                        if (!((packet.active >> r) & 1)) continue;
+                        Vec3f orig = packet.orig(r), dir = packet.dir(r), hit_pt, N, diffuse;
+                        uint32_t material_id = Scene::no_material;
+                        bool hit = resolve_hit(orig, dir, scene, packet.sphere[r], packet.t[r], material_id, diffuse, hit_pt, N);
+                        RT_STAT_RAYS(Primary, 0, 1);
+                        RT_STAT_HITS(0, 1, hit);
+                        Vec3f color;
+                        if (hit)
+                        {
+                            Material material = scene.surface(material_id, diffuse);
+                            color = shade(dir, scene, 0, 1.f, material, hit_pt, N);
+                        }
+                        else
+                            color = background_color(orig, dir);
+                        sums[r] = sums[r] + color;
+                    }
+                }
+
+                for (int r = 0; r < RayPacket::size; ++r)
+                    if ((packet.active >> r) & 1)
+                        frame.add_samples(bx + r % RayPacket::width, by + r / RayPacket::width, sums[r], first, count);
+            }
+        }
+    }
+    else
+    {
+        for (size_t j = y0; j < y1; ++j)
+        {
+            for (size_t i = x0; i < x1; ++i)
+            {
+                Vec3f sum(0.f, 0.f, 0.f);
+                for (int s = first; s < first + count; ++s)
+                {
+                    RT_STAT_RAYS(Primary, 0, 1);
+                    sum = sum + cast_ray(camera.origin(), camera.dir(i, j, s), scene, 0);
+                }
+                frame.add_samples(i, j, sum, first, count);
+            }
+        }
+    }
+}
+
+// Renders every fourth tile with both engines and prints their speed and the largest channel difference,
+// the two must agree up to float rounding
+void report_wavefront(const Scene& scene, const Camera& camera)
+{
+    Framebuffer recursive(camera.width(), camera.height()), wavefront(camera.width(), camera.height());
+    recursive.clear();
+    wavefront.clear();
+    Wavefront engine;
+
+    double recursive_ms = 0, wavefront_ms = 0;
+    for (int y0 = 0; y0 < camera.height(); y0 += tile_size)
+    {
+        for (int x0 = (y0 / tile_size) % 4 * tile_size; x0 < camera.width(); x0 += 4 * tile_size)
         {
-            float x = i - w_width / 2.;  
-            float y = w_height / 2. - j;
-            float z = -w_height / (2 * tan(fov / 2));
-            pixelInfo[i + j * w_width] = std::make_unique<Vec3f>(cast_ray(Vec3f(0.f, 0.f, 0.f), Vec3f(x, y, z).normalize(), spheres, lit, 0));
+            int x1 = std::min(x0 + tile_size, camera.width()), y1 = std::min(y0 + tile_size, camera.height());
+            auto start = std::chrono::high_resolution_clock::now();
+            render_tile_recursive(scene, camera, x0, y0, x1, y1, 0, 1, recursive);
+            auto mid = std::chrono::high_resolution_clock::now();
+            engine.render_tile(scene, camera, x0, y0, x1, y1, 0, 1, wavefront);
+            auto end = std::chrono::high_resolution_clock::now();
+            recursive_ms += std::chrono::duration<double, std::milli>(mid - start).count();
+            wavefront_ms += std::chrono::duration<double, std::milli>(end - mid).count();
         }
     }
 
-    write_to_file("Raytracer.ppm", pixelInfo, w_width, w_height);
+    float max_diff = 0;
+    for (size_t k = 0; k < recursive.pixel_count() * Framebuffer::channels; ++k)
+        max_diff = std::max(max_diff, std::fabs(recursive.data()[k] - wavefront.data()[k]));
+
+    std::cout << "Wavefront: " << wavefront_ms << " ms vs recursive " << recursive_ms << " ms on a quarter of the tiles, "
+        << engine.rays_traced << " rays, max difference " << max_diff << std::endl;
 }
 
-// Method to create a new file with all the pixel information
-void write_to_file(const char* filename, std::vector<std::unique_ptr<Vec3f>>& pixelInfo, size_t width, size_t height)
+// Edits the scene the way a look-dev session does, renders only the tiles the edit touches (see TileDependencies)
+// and compares them with a full render of the edited scene, which must match exactly. The edits are the diffuse
+// colour of the first sphere's material and the intensity of the first light, made on a copy of the scene
+void report_incremental(const Scene& original, const Camera& camera, ThreadPool& pool)
 {
-    std::ofstream f(filename, std::ios::binary);
+    if (original.spheres.empty() || original.lights.empty())
+    {
+        std::cout << "Incremental: skipped, the edits need a sphere and a light and the scene has "
+            << original.spheres.size() << " spheres and " << original.lights.size() << " lights" << std::endl;
+        return;
+    }
+    Scene scene = original;
+
+    Framebuffer incremental, full;
+    TileDependencies deps;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<TileStats> tiles = render_frame(scene, camera, pool, incremental, 0, 1, nullptr, &deps);
+    double frame_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    auto compare = [&](const char* edit, const std::vector<uint32_t>& changed) {
+        auto start = std::chrono::high_resolution_clock::now();
+        render_frame(scene, camera, pool, incremental, 0, 1, &changed, &deps);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        render_frame(scene, camera, pool, full, 0, 1);
+        float max_diff = 0;
+        for (size_t k = 0; k < full.pixel_count() * Framebuffer::channels; ++k)
+            max_diff = std::max(max_diff, std::fabs(full.data()[k] - incremental.data()[k]));
+        std::cout << "Incremental: " << edit << " edit renders " << changed.size() << " of " << tiles.size() << " tiles in " << ms
+            << " ms vs " << frame_ms << " ms for the frame, max difference " << max_diff << std::endl;
+    };
+
+    uint32_t id = scene.spheres[0]->material;
+    Vec3f colour = scene.materials[id].diffuse_color;
+    std::vector<uint32_t> changed = deps.material_changed(scene, id);
+    scene.materials[id].diffuse_color = Vec3f(colour.z, colour.x, colour.y);
+    compare("material", changed);
+    scene.materials[id].diffuse_color = colour;
+    render_frame(scene, camera, pool, incremental, 0, 1, &changed, &deps);
+
+    float intensity = scene.lights[0]->intensity;
+    scene.lights[0]->intensity = intensity * 2;
+    compare("light", deps.light_changed(0, false));
+    scene.lights[0]->intensity = intensity;
+}
 
-    f << "P6\n" << width << " " << height << "\n255\n";
-    for (int i = 0; i < width * height; ++i)
+// Per tile and per worker timings of a frame. max/mean of the worker busy time is the load imbalance,
+// 1.0 means every core was busy until the end
+void report_tiles(const std::vector<TileStats>& tiles, const ThreadPool& pool)
+{
+    if (tiles.empty()) return;
+
+    std::vector<double> busy(pool.size());
+    double total = 0, slowest = 0, fastest = std::numeric_limits<double>::max();
+    const TileStats* worst = &tiles[0];
+    for (const TileStats& t : tiles)
     {
-        float max = std::max(pixelInfo[i]->x, std::max(pixelInfo[i]->y, pixelInfo[i]->z));
-        if (max > 1) *pixelInfo[i] = *(pixelInfo[i]) * (1. / max);
-        for (int k = 0; k < 3; ++k)
+        busy[t.worker] += t.ms;
+        total += t.ms;
+        fastest = std::min(fastest, t.ms);
+        if (t.ms > slowest)
         {
-            f << (char)(255 * std::max(0.f, std::min(1.f, (*pixelInfo[i])[k])));
+            slowest = t.ms;
+            worst = &t;
         }
     }
 
-    f.close();
+    double max_busy = *std::max_element(busy.begin(), busy.end());
+    std::cout << "Tiles: " << tiles.size() << " of " << tile_size << "x" << tile_size << " on " << pool.size() << " threads, "
+        << "min " << fastest << " / mean " << total / tiles.size() << " / max " << slowest << " ms"
+        << " (slowest at " << worst->x0 << "," << worst->y0 << "), imbalance " << max_busy / (total / pool.size()) << "\n";
+    for (unsigned w = 0; w < pool.size(); ++w)
+        std::cout << "  worker " << w << ": busy " << busy[w] << " ms, stole " << pool.steals(w) << " tiles\n";
+    std::cout.flush();
 }
 
-Vec3f cast_ray(const Vec3f& orig, const Vec3f& dir, const std::vector<std::unique_ptr<Sphere>>& spheres, const std::vector<std::unique_ptr<Light>>& lit, int depth) {
-    Vec3f hit_pt, N;
-    Material material{};
-    if (depth > 5 || !pixel_depth_check(orig, dir, spheres, material, hit_pt, N)) {
+// Method to create a new file with all the pixel information. A name ending in ".png" gives a PNG, anything else a PPM
+void write_to_file(const char* filename, const Framebuffer& frame, ThreadPool& pool)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<uint8_t> rgb;
+    quantise_frame(frame, pool, rgb);
+
+    size_t len = std::strlen(filename);
+    bool png = len >= 4 && std::tolower(filename[len - 4]) == '.' && std::tolower(filename[len - 3]) == 'p'
+        && std::tolower(filename[len - 2]) == 'n' && std::tolower(filename[len - 1]) == 'g';
+    bool ok = png ? write_png(filename, frame.width(), frame.height(), rgb, pool)
+        : write_ppm(filename, frame.width(), frame.height(), rgb);
+
+    if (!ok)
+        std::cerr << "Could not write " << filename << "\n";
+    else
+        std::cout << "Wrote " << filename << " in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms\n";
+}
+
+Vec3f cast_ray(const Vec3f& orig, const Vec3f& dir, const Scene& scene, int depth, float weight) {
+    Vec3f hit_pt, N, diffuse;
+    uint32_t material_id = Scene::no_material;
+    if (depth > max_depth) {
+        return background_color(orig, dir);
+    }
+    bool hit = pixel_depth_check(orig, dir, scene, material_id, diffuse, hit_pt, N);
+    RT_STAT_HITS(depth, 1, hit);
+    if (!hit) {
         return background_color(orig, dir);
     }
 
+    // The material is fetched once, for the hit that is actually shaded
+    Material material = scene.surface(material_id, diffuse);
+    return shade(dir, scene, depth, weight, material, hit_pt, N);
+}
+
+// Colour at a resolved hit: reflection and refraction recurse through cast_ray, then the lights are summed.
+// 'weight' is how much this hit contributes to the pixel, it decides which secondary rays are worth tracing
+Vec3f shade(const Vec3f& dir, const Scene& scene, int depth, float weight, Material& material, const Vec3f& hit_pt, const Vec3f& N)
+{
     // Reflection Recursion
-    Vec3f reflec_dir = reflect(dir, N).normalize();
-    Vec3f reflec_orig = reflec_dir * N < 0 ? hit_pt - N * 1e-3 : hit_pt + N * 1e-3;
-    Vec3f reflec_color = cast_ray(reflec_orig, reflec_dir, spheres, lit, depth + 1);
+    Vec3f reflec_color{};
+    Vec3f reflec_orig, reflec_dir;
+    reflection_ray(dir, N, hit_pt, reflec_orig, reflec_dir);
+    float reflec_scale = secondary_scale(weight * material.albedo[2], reflec_orig, reflec_dir);
+    if (reflec_scale > 0)
+    {
+        RT_STAT_RAYS(Reflection, depth + 1, 1);
+        reflec_color = cast_ray(reflec_orig, reflec_dir, scene, depth + 1, weight * material.albedo[2] * reflec_scale) * reflec_scale;
+    }
 
     // Refraction recursion
-    Vec3f refrac_dir = refract(dir, N, material.refractive_index, 1.0f).normalize();
-    Vec3f refr_orig = refrac_dir * N < 0 ? hit_pt - N * 1e-2 : hit_pt + N * 1e-2;
-    Vec3f refrac_color = cast_ray(refr_orig, refrac_dir, spheres, lit, depth+1);
+    Vec3f refrac_color{};
+    Vec3f refr_orig, refrac_dir;
+    refraction_ray(dir, N, hit_pt, material.refractive_index, refr_orig, refrac_dir);
+    float refrac_scale = secondary_scale(weight * material.albedo[3], refr_orig, refrac_dir);
+    if (refrac_scale > 0)
+    {
+        RT_STAT_RAYS(Refraction, depth + 1, 1);
+        refrac_color = cast_ray(refr_orig, refrac_dir, scene, depth+1, weight * material.albedo[3] * refrac_scale) * refrac_scale;
+    }
+
+    material.diffuse_color = direct_light(dir, scene, material, hit_pt, N) + reflec_color * material.albedo[2] + refrac_color * material.albedo[3];
+    return material.diffuse_color;
+}
+
+// Factor a secondary ray's colour is multiplied with, 0 when the ray isn't traced at all (see Termination).
+// A zero weight gives 0 in every mode, the colour would be multiplied by 0 anyway.
+// The roulette draws from a hash of the ray itself, so both engines and every thread count make the same choices
+float secondary_scale(float weight, const Vec3f& orig, const Vec3f& dir)
+{
+    float contribution = std::fabs(weight);
+    if (contribution == 0.f)
+        return 0.f;
+    if (ray_termination == Termination::Exact || contribution >= min_contribution)
+        return 1.f;
+    if (ray_termination == Termination::Threshold)
+        return 0.f;
+
+    uint32_t h = 2166136261u;
+    for (float f : { orig.x, orig.y, orig.z, dir.x, dir.y, dir.z })
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        h = (h ^ bits) * 16777619u;
+    }
+    h ^= h >> 15; h *= 0x2c1b3c6du; h ^= h >> 12;
+    float u = (h >> 8) * (1.f / 16777216.f);
 
+    float survival = contribution / min_contribution;
+    return u < survival ? 1.f / survival : 0.f;
+}
+
+// Diffuse and specular light from every unshadowed light, the part of a hit's colour that needs no secondary rays
+Vec3f direct_light(const Vec3f& dir, const Scene& scene, const Material& material, const Vec3f& hit_pt, const Vec3f& N)
+{
+    const std::vector<std::unique_ptr<Light>>& lit = scene.lights;
     float diffuse_light_intensity{}, specular_light_intensity{};
+    record_shaded();
     for (size_t i = 0; i < lit.size(); ++i)
     {
         Vec3f light_dir = (lit[i]->position - hit_pt).normalize();
@@ -128,52 +591,214 @@ Vec3f cast_ray(const Vec3f& orig, const Vec3f& dir, const std::vector<std::uniqu
 
         // Shadow prediction
         Vec3f shadow_orig = (light_dir * N) < 0 ? hit_pt - N*1e-3  : hit_pt + N*1e-3;
-        Vec3f shad_inters_pt, shad_N;
-        Material tmpmaterial{};
-        if ((light_dir*N < 0)||(pixel_depth_check(shadow_orig, light_dir, spheres, tmpmaterial, shad_inters_pt, shad_N) && (shad_inters_pt - shadow_orig).norm() < light_dist))
+        if (light_dir*N < 0)
             continue;
+        bool blocked = occluded(shadow_orig, light_dir, light_dist, scene);
+        RT_STAT_SHADOW(blocked);
+        if (blocked)
+            continue;
+        record_light(uint32_t(i));
 
         diffuse_light_intensity += lit[i]->intensity * std::max(0.0f, (light_dir * N));
         specular_light_intensity += powf(std::max(0.0f, reflect(light_dir, N) * dir), material.sp_exp) * lit[i]->intensity;
     }
-    material.diffuse_color = material.diffuse_color * (diffuse_light_intensity * material.albedo[0] + specular_light_intensity * material.albedo[1]) + reflec_color * material.albedo[2] + refrac_color * material.albedo[3];
-    return material.diffuse_color;
+    return material.diffuse_color * (diffuse_light_intensity * material.albedo[0] + specular_light_intensity * material.albedo[1]);
+}
+
+// Secondary rays leave the surface slightly offset so they don't hit it again
+void reflection_ray(const Vec3f& dir, const Vec3f& N, const Vec3f& hit_pt, Vec3f& orig_out, Vec3f& dir_out)
+{
+    dir_out = reflect(dir, N).normalize();
+    orig_out = dir_out * N < 0 ? hit_pt - N * 1e-3 : hit_pt + N * 1e-3;
+}
+
+void refraction_ray(const Vec3f& dir, const Vec3f& N, const Vec3f& hit_pt, float refractive_index, Vec3f& orig_out, Vec3f& dir_out)
+{
+    dir_out = refract(dir, N, refractive_index, 1.0f).normalize();
+    orig_out = dir_out * N < 0 ? hit_pt - N * 1e-2 : hit_pt + N * 1e-2;
 }
 
-bool pixel_depth_check(const Vec3f& orig, const Vec3f& dir, const std::vector<std::unique_ptr<Sphere>>& spheres, Material& material, Vec3f& hit_pt, Vec3f& normal)
+bool pixel_depth_check(const Vec3f& orig, const Vec3f& dir, const Scene& scene, uint32_t& material, Vec3f& diffuse_color, Vec3f& hit_pt, Vec3f& normal)
 {
+    RT_STAT_TIME(Intersect);
     float sphere_dist = std::numeric_limits<float>::max();
+    int closest = -1;
+
+    // Only the leaves the ray actually reaches are tested, a leaf is one SIMD batch of the SoA spheres.
+    // Material id and normal are fetched once for the winner
+    const SphereSoA& soa = scene.sphere_soa;
+    scene.bvh.traverse(orig, dir, sphere_dist, [&](uint32_t first, uint32_t count, float& t_max) {
+        int hit = soa.closest_hit(first, count, orig, dir, t_max);
+        if (hit >= 0) closest = hit;
+    });
+
+    return resolve_hit(orig, dir, scene, closest, sphere_dist, material, diffuse_color, hit_pt, normal);
+}
+
+// Turns the closest sphere found by a traversal (SoA index, -1 for none) into material id, diffuse colour, hit
+// point and normal, after checking whether a mesh instance or a shape is closer still. Shared by
+// pixel_depth_check and the primary ray packets, so instances and shapes are traced one ray at a time on both
+// paths. Only the winner is looked at: its material, normal and texture are evaluated once
+bool resolve_hit(const Vec3f& orig, const Vec3f& dir, const Scene& scene, int closest, float sphere_dist, uint32_t& material, Vec3f& diffuse_color, Vec3f& hit_pt, Vec3f& normal)
+{
+    float nearest = sphere_dist;
+    uint32_t instance = 0, triangle = 0, shape = 0;
+    bool mesh_hit = scene.instance_hit(orig, dir, nearest, instance, triangle);
+    bool shape_hit = scene.shape_hit(orig, dir, nearest, shape);
+    if (nearest >= 1000.f)
+        return false;
+
+    hit_pt = orig + dir * nearest;
+    if (shape_hit)
+    {
+        const Shape& s = scene.shapes[shape];
+        material = s.material;
+        normal = s.normal(hit_pt);
+        diffuse_color = s.texture.at(hit_pt, normal, scene.material(material).diffuse_color);
+        record_shape(shape);
+    }
+    else if (mesh_hit)
+    {
+        const MeshInstance& inst = scene.instances[instance];
+        material = inst.material;
+        diffuse_color = scene.materials[material].diffuse_color;
+        normal = inst.normal(scene.meshes[inst.mesh], triangle);
+        record_instance(instance);
+    }
+    else
+    {
+        const SphereSoA& soa = scene.sphere_soa;
+        material = soa.mat_id[closest];
+        diffuse_color = scene.materials[material].diffuse_color;
+        normal = (hit_pt - soa.centre(closest)).normalize();
+        record_sphere(soa.sphere_id[closest]);
+    }
+    return true;
+}
+
+// Shadow query: is anything between orig and orig + dir * t_max? Stops at the first blocker and never
+// touches materials or normals
+bool occluded(const Vec3f& orig, const Vec3f& dir, float t_max, const Scene& scene)
+{
+    RT_STAT_TIME(Shadow);
+    const SphereSoA& soa = scene.sphere_soa;
+    if (scene.bvh.traverse_any(orig, dir, t_max, [&](uint32_t first, uint32_t count) {
+        return soa.any_hit(first, count, orig, dir, t_max);
+    }))
+        return true;
+    return scene.instance_occluded(orig, dir, t_max) || scene.shape_occluded(orig, dir, t_max);
+}
 
-    for (size_t i = 0; i < spheres.size(); ++i)
+// Times closest-sphere queries for a grid of primary rays through the BVH (SIMD leaves) and through the plain
+// linear loop over Sphere::ray_intersect it replaced, so the payoff on the current scene is visible
+void report_bvh(const Scene& scene, const Camera& camera)
+{
+    std::vector<Vec3f> dirs;
+    for (int j = 0; j < camera.height(); j += 4)
     {
-        float dist{};
+        for (int i = 0; i < camera.width(); i += 4)
+        {
+            dirs.push_back(camera.dir(i, j));
+        }
+    }
+    const Vec3f orig = camera.origin();
 
-        if (spheres[i]->ray_intersect(orig, dir, dist) && dist < sphere_dist)
+    size_t bvh_hits = 0, linear_hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const Vec3f& dir : dirs)
+    {
+        float t = std::numeric_limits<float>::max();
+        scene.bvh.traverse(orig, dir, t, [&](uint32_t first, uint32_t count, float& t_max) {
+            scene.sphere_soa.closest_hit(first, count, orig, dir, t_max);
+        });
+        bvh_hits += t < std::numeric_limits<float>::max();
+    }
+    double bvh_ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / dirs.size();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (const Vec3f& dir : dirs)
+    {
+        float t = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < scene.spheres.size(); ++i)
         {
-            sphere_dist = dist;
-            material = spheres[i]->materiall;
-            hit_pt = orig + dir * dist;
-            normal = (hit_pt - spheres[i]->centre).normalize();
+            float dist{};
+            if (scene.spheres[i]->ray_intersect(orig, dir, dist) && dist < t)
+                t = dist;
         }
+        linear_hits += t < std::numeric_limits<float>::max();
+    }
+    double linear_ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / dirs.size();
+
+    std::cout << "BVH: " << scene.spheres.size() << " spheres, " << scene.bvh.nodes.size() << " nodes, "
+        << scene.bvh.leaf_count << " leaves, depth " << scene.bvh.max_depth << ", built in " << scene.bvh.build_ms << " ms, "
+        << SphereSoA::lane_width << " spheres per SIMD test\n";
+    std::cout << "BVH query: " << bvh_ns << " ns/ray vs linear " << linear_ns << " ns/ray ("
+        << linear_ns / std::max(bvh_ns, 1e-9) << "x) over " << dirs.size() << " primary rays";
+    if (bvh_hits != linear_hits) std::cout << " [hit count mismatch " << bvh_hits << " vs " << linear_hits << "]";
+    std::cout << std::endl;
+
+    // What the two levels hold against every instance owning a transformed copy of its mesh's triangles and BVH
+    if (scene.instances.empty()) return;
+    size_t unique_bytes = scene.instances.capacity() * sizeof(MeshInstance) + scene.instance_bvh.nodes.capacity() * sizeof(BVHNode)
+        + scene.instance_bvh.prim_indices.capacity() * sizeof(uint32_t), flat_bytes = 0, triangles = 0;
+    for (const TriangleMesh& mesh : scene.meshes)
+        unique_bytes += mesh.memory_bytes();
+    for (const MeshInstance& instance : scene.instances)
+    {
+        flat_bytes += scene.meshes[instance.mesh].memory_bytes();
+        triangles += scene.meshes[instance.mesh].triangle_count();
     }
+    std::cout << "Instances: " << scene.instances.size() << " of " << scene.meshes.size() << " meshes, " << triangles << " triangles, top level "
+        << scene.instance_bvh.nodes.size() << " nodes built in " << scene.instance_bvh.build_ms << " ms, " << unique_bytes / 1048576.0
+        << " MB vs " << flat_bytes / 1048576.0 << " MB flattened (" << double(flat_bytes) / std::max<size_t>(unique_bytes, 1) << "x)" << std::endl;
+}
 
-    float board_dist = std::numeric_limits<float>::max();
-    if (fabs(dir.y) > 1e-3)
+// Closest hit for every primary ray of the frame, one ray at a time and as 4x4 packets
+void report_packets(const Scene& scene, const Camera& camera)
+{
+    const Vec3f orig = camera.origin();
+    size_t single_hits = 0, packet_hits = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int j = 0; j < camera.height(); ++j)
     {
-        float d = -(orig.y + 4) / dir.y;
-        Vec3f pt = orig + dir * d;
+        for (int i = 0; i < camera.width(); ++i)
+        {
+            Vec3f dir = camera.dir(i, j);
+            float t = std::numeric_limits<float>::max();
+            scene.bvh.traverse(orig, dir, t, [&](uint32_t first, uint32_t count, float& t_max) {
+                scene.sphere_soa.closest_hit(first, count, orig, dir, t_max);
+            });
+            single_hits += t < std::numeric_limits<float>::max();
+        }
+    }
+    double single_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
 
-        if (d > 0 && fabs(pt.x) < 10 && pt.z <-10 && pt.z >-30)
+    start = std::chrono::high_resolution_clock::now();
+    RayPacket packet;
+    for (int by = 0; by < camera.height(); by += RayPacket::height)
+    {
+        for (int bx = 0; bx < camera.width(); bx += RayPacket::width)
         {
-            board_dist = d;
-            if (board_dist < sphere_dist)
-                normal = Vec3f(0.0f, 1.0f, 0.0f);
-            int ff = int(pt.x) + int(pt.z);
-            material.diffuse_color = (int(pt.x+1000) + int(pt.z)) & 1 ? Vec3f(1, 1, 1) : Vec3f(1, .7, .3);
+            packet.active = 0;
+            for (int r = 0; r < RayPacket::size; ++r)
+            {
+                int i = bx + r % RayPacket::width, j = by + r / RayPacket::width;
+                packet.set(r, orig, i < camera.width() && j < camera.height() ? camera.dir(i, j) : Vec3f(0.f, 0.f, -1.f));
+                if (i >= camera.width() || j >= camera.height()) packet.active &= ~(1u << r);
+            }
+            packet_closest_hit(packet, scene);
+            for (int r = 0; r < RayPacket::size; ++r)
+                packet_hits += ((packet.active >> r) & 1) && packet.sphere[r] >= 0;
         }
     }
+    double packet_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
 
-    return std::min(board_dist,sphere_dist) < 1000.f;
+    double rays = double(camera.width()) * camera.height();
+    std::cout << "Primary rays: single " << rays / single_s * 1e-6 << " Mrays/s, 4x4 packets " << rays / packet_s * 1e-6
+        << " Mrays/s (" << single_s / packet_s << "x)";
+    if (single_hits != packet_hits) std::cout << " [hit count mismatch " << single_hits << " vs " << packet_hits << "]";
+    std::cout << std::endl;
 }
 
 Vec3f refract(const Vec3f& I, const Vec3f& N, const float refracted_indx, const float inc_indx)
@@ -195,18 +820,49 @@ Vec3f refract(const Vec3f& I, const Vec3f& N, const float refracted_indx, const
     if (d < 0)
         return Vec3f(1.0f, 0.0f, 0.0f);
     else
-        return (I * ind_ratio + normal_refr * (ind_ratio * cosi - std::sqrtf(d)));
+        return (I * ind_ratio + normal_refr * (ind_ratio * cosi - std::sqrt(d)));
 }
 
 Vec3f background_color(const Vec3f& orig, const Vec3f& dir)
 {
-    // NOTE: for fish eye effect, we can use asin, acos but for straight/plain image use atan2
-    // Also, the reflection using sin and cos are fisheyed, but with atan2, it'll fade to infinity
+    RT_STAT_TIME(Background);
+    RT_STAT_ENVMAP();
+    return envmap.lookup(dir);
+}
+
+// Load time of the environment map. After a fresh decode also the speed of the cube map lookups against
+// the original atan2 lookup, and how far their colours are apart
+void report_envmap(const EnvMap& env)
+{
+    std::cout << "Envmap: " << (env.from_cache() ? "mapped from cache " + env.cache_file() : "decoded and converted") << " in " << env.load_ms << " ms\n";
+    if (!env.has_source())
+    {
+        std::cout.flush();
+        return;
+    }
 
-    int x_raw = std::abs((std::atan2(dir.z, dir.x) / (2 * M_PI)) * envmap_width);   //+ 2 * envmap_width / (2 * M_PI)
-    int y_raw = std::abs((std::atan2(dir.z, dir.y) / M_PI) * envmap_height);        // +  envmap_height/M_PI
+    std::vector<Vec3f> dirs(1 << 20);
+    std::mt19937 rng(7);
+    std::normal_distribution<float> gauss;
+    for (Vec3f& d : dirs)
+        d = Vec3f(gauss(rng), gauss(rng), gauss(rng)).normalize();
 
-    int x = std::max(0,std::min(x_raw,envmap_width-1));
-    int y = std::max(0, std::min(y_raw, envmap_height - 1));
-    return envmap[x + y * envmap_width];
-}
\ No newline at end of file
+    std::vector<Vec3f> legacy(dirs.size()), cube(dirs.size());
+    double ns[3];
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        std::vector<Vec3f>& out = pass == 0 ? legacy : cube;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < dirs.size(); ++i)
+            out[i] = pass == 0 ? env.lookup_legacy(dirs[i]) : env.lookup(dirs[i], pass == 2);
+        ns[pass] = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / dirs.size();
+        if (pass == 1)
+        {
+            double diff = 0;
+            for (size_t i = 0; i < dirs.size(); ++i)
+                diff += std::fabs(cube[i].x - legacy[i].x) + std::fabs(cube[i].y - legacy[i].y) + std::fabs(cube[i].z - legacy[i].z);
+            std::cout << "Envmap: " << env.size() << "^2 cube faces, mean difference to atan2 lookup " << diff / (3 * dirs.size()) << "\n";
+        }
+    }
+    std::cout << "Envmap lookup: atan2 " << ns[0] << " ns, cube nearest " << ns[1] << " ns, cube bilinear " << ns[2] << " ns" << std::endl;
+}
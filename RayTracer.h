@@ -1,16 +1,60 @@
 #ifndef RAYTRACER_H
 #define RAYTRACER_H
 
+#include <vector>
+#include <memory>
+#include <string>
 #include "Geometry.h"
+#include "BVH.h"
+#include "SphereSoA.h"
+#include "Mesh.h"
+#include "Shape.h"
+#include "ThreadPool.h"
+#include "Framebuffer.h"
+#include "Packet.h"
+#include "Wavefront.h"
+#include "EnvMap.h"
+#include "Camera.h"
 
 // Don't want to slow down the exection time? use "contexpr"
+// The size and fov are the defaults of RenderSettings, and the size render() has a FixedCamera for
 constexpr int w_width = 1024;
 constexpr int w_height = 768;
-constexpr auto M_PI = 3.14159265358979323846;
-constexpr auto fov = M_PI / 2;
+constexpr auto pi = 3.14159265358979323846;
+constexpr auto fov = pi / 2;
+constexpr int tile_size = 32;	// render() hands out tile_size x tile_size blocks of pixels to the thread pool
+constexpr bool use_packets = true;	// trace primary rays as 4x4 RayPackets, see Packet.h
+constexpr int max_depth = 5;		// rays deeper than this take the background colour
+
+// Recursive : cast_ray per pixel, the reference
+// Wavefront : bounce generations processed in bulk per tile, see Wavefront.h
+enum class Engine { Recursive, Wavefront };
+constexpr Engine render_engine = Engine::Wavefront;
+
+// What happens to a reflection / refraction ray whose contribution to the pixel (product of the albedos
+// along its path) is below min_contribution
+// Exact           : traced anyway, the reference
+// Threshold       : dropped
+// RussianRoulette : traced with probability contribution / min_contribution and weighted up to compensate
+// The other two change the image, so they are opt-in (--termination, --min-contribution). A ray that
+// contributes nothing at all, off a surface with a zero reflect or refract albedo, is never traced in any mode
+enum class Termination { Exact, Threshold, RussianRoulette };
+constexpr Termination default_termination = Termination::Exact;
+constexpr float default_min_contribution = 1e-3f;
 
 class Sphere;
-class Light;
+struct Light;
+struct Scene;
+struct RenderSettings;
+class TileDependencies;
+
+// Wall time of one tile, collected by render() to show load imbalance
+struct TileStats
+{
+	int x0{}, y0{};
+	double ms{};
+	unsigned worker{};
+};
 
 struct Material
 {
@@ -34,23 +78,46 @@ struct Material
 	}*/
 };
 
-void render(const std::vector<std::unique_ptr<Sphere>>& spheres, const std::vector<std::unique_ptr<Light>>& lit);
-void write_to_file(const char* filename, std::vector<std::unique_ptr<Vec3f>>& pixelInfo, size_t width, size_t height);
-Vec3f cast_ray(const Vec3f& orig, const Vec3f& dir, const std::vector<std::unique_ptr<Sphere>>& spheres, const std::vector<std::unique_ptr<Light>>& lit, int depth=0);
-bool pixel_depth_check(const Vec3f& orig, const Vec3f& dir, const std::vector<std::unique_ptr<Sphere>>& spheres, Material& material, Vec3f& hit_pt, Vec3f& normal);
+void demo_scene(Scene& scene);
+void render(const Scene& scene, ThreadPool& pool, Framebuffer& frame, const RenderSettings& settings);
+void render_animation(Scene& scene, ThreadPool& pool, Framebuffer& frame, const RenderSettings& settings);
+template <class Cam> void render_progressive(const Scene& scene, const Cam& camera, ThreadPool& pool, Framebuffer& frame, const RenderSettings& settings);
+template <class Cam> std::vector<TileStats> render_frame(const Scene& scene, const Cam& camera, ThreadPool& pool, Framebuffer& frame, int first, int count,
+	const std::vector<uint32_t>* active = nullptr, TileDependencies* deps = nullptr);
+template <class Cam> void render_tile_recursive(const Scene& scene, const Cam& camera, int x0, int y0, int x1, int y1, int first, int count, Framebuffer& frame);
+void report_tiles(const std::vector<TileStats>& tiles, const ThreadPool& pool);
+void report_wavefront(const Scene& scene, const Camera& camera);
+void report_incremental(const Scene& scene, const Camera& camera, ThreadPool& pool);
+void write_to_file(const char* filename, const Framebuffer& frame, ThreadPool& pool);
+Vec3f cast_ray(const Vec3f& orig, const Vec3f& dir, const Scene& scene, int depth=0, float weight=1.f);
+Vec3f shade(const Vec3f& dir, const Scene& scene, int depth, float weight, Material& material, const Vec3f& hit_pt, const Vec3f& N);
+float secondary_scale(float weight, const Vec3f& orig, const Vec3f& dir);
+Vec3f direct_light(const Vec3f& dir, const Scene& scene, const Material& material, const Vec3f& hit_pt, const Vec3f& N);
+void reflection_ray(const Vec3f& dir, const Vec3f& N, const Vec3f& hit_pt, Vec3f& orig_out, Vec3f& dir_out);
+void refraction_ray(const Vec3f& dir, const Vec3f& N, const Vec3f& hit_pt, float refractive_index, Vec3f& orig_out, Vec3f& dir_out);
+bool pixel_depth_check(const Vec3f& orig, const Vec3f& dir, const Scene& scene, uint32_t& material, Vec3f& diffuse_color, Vec3f& hit_pt, Vec3f& normal);
+bool resolve_hit(const Vec3f& orig, const Vec3f& dir, const Scene& scene, int closest, float sphere_dist, uint32_t& material, Vec3f& diffuse_color, Vec3f& hit_pt, Vec3f& normal);
+bool occluded(const Vec3f& orig, const Vec3f& dir, float t_max, const Scene& scene);
+void report_bvh(const Scene& scene, const Camera& camera);
+void report_packets(const Scene& scene, const Camera& camera);
 Vec3f refract(const Vec3f& I, const Vec3f& N, const float refracted_index, const float inc_index = 1);
 Vec3f background_color(const Vec3f& orig, const Vec3f& dir);
+void report_envmap(const EnvMap& env);
+
+extern EnvMap envmap;
+extern Termination ray_termination;	// from RenderSettings, set by main()
+extern float min_contribution;
 
 class Sphere
 {
 public:
 	Vec3f centre{};
 	float radius{};
-	Material materiall{};
+	uint32_t material{};	// index into Scene::materials
 
 	Sphere() = delete;
 
-	Sphere(const Vec3f& c, float r, const Material& m) : centre{ c }, radius{ r }, materiall{ m } {}
+	Sphere(const Vec3f& c, float r, uint32_t m) : centre{ c }, radius{ r }, material{ m } {}
 
 	// R0	: Starting point of ray
 	// dir	: Direction of ray(unit vector)
@@ -65,7 +132,7 @@ public:
 
 		if (d > radius * radius) return false;
 		// Find distance from projection to intersetion point
-		float dist = std::sqrtf(radius * radius - d);
+		float dist = std::sqrt(radius * radius - d);
 		// Find distance from ray starting point till intersection point
 		intersection_pt = c_proj - dist;
 
@@ -74,6 +141,8 @@ public:
 
 		return true;
 	}
+
+	AABB bounds() const { return AABB(centre - Vec3f(radius, radius, radius), centre + Vec3f(radius, radius, radius)); }
 };
 
 struct Light
@@ -83,4 +152,254 @@ struct Light
 	Light(const Vec3f& pos, float strength) : position{ pos }, intensity{ strength } {}
 };
 
+// Path of the camera, of one sphere's centre or of one instance's position over an animation: linear between keyframes, held before the
+// first and after the last
+struct Keyframe
+{
+	int frame{};
+	Vec3f position{};
+};
+
+struct Track
+{
+	static constexpr uint32_t camera = ~0u;
+	static constexpr uint32_t instance = 1u << 31;	// set on an index into Scene::instances
+	uint32_t target = camera;		// sphere index, instance | instance index, or camera
+	std::vector<Keyframe> keys;		// sorted by frame
+
+	Vec3f at(int frame) const
+	{
+		if (frame <= keys.front().frame) return keys.front().position;
+		if (frame >= keys.back().frame) return keys.back().position;
+		size_t k = 1;
+		while (keys[k].frame < frame) ++k;
+		const Keyframe& a = keys[k - 1];
+		const Keyframe& b = keys[k];
+		float t = float(frame - a.frame) / float(b.frame - a.frame);
+		return a.position * (1.f - t) + b.position * t;
+	}
+};
+
+// Everything a ray can see. Call build_bvh() after the spheres, instances and shapes are added, update_bvh()
+// after spheres moved and build_instance_bvh() after instances did
+struct Scene
+{
+	// Spheres, instances and shapes refer to their material by index. A shape can have no_material, which shades
+	// like a default Material painted by the shape's texture
+	static constexpr uint32_t no_material = ~0u;
+	std::vector<Material> materials;
+	static inline const Material shape_material{};
+
+	const Material& material(uint32_t id) const { return id == no_material ? shape_material : materials[id]; }
+
+	// The Material shading works with: the table entry, with the diffuse colour resolve_hit settled on
+	Material surface(uint32_t id, const Vec3f& diffuse_color) const
+	{
+		Material m = material(id);
+		m.diffuse_color = diffuse_color;
+		return m;
+	}
+
+	std::vector<std::unique_ptr<Sphere>> spheres;
+	std::vector<std::unique_ptr<Light>> lights;
+
+	// Two levels: every mesh once with its own BVH, built when it was loaded, and a BVH over the instances
+	// that place them. Memory grows with the unique geometry, moving instances only rebuilds the top level
+	std::vector<TriangleMesh> meshes;
+	std::vector<MeshInstance> instances;
+	BVH instance_bvh;
+
+	// Planes, boxes and discs. The bounded ones have a BVH of their own, bounded_shapes maps its primitives
+	// back to shapes, the planes are tested one by one
+	std::vector<Shape> shapes;
+	BVH shape_bvh;
+	std::vector<uint32_t> bounded_shapes, unbounded_shapes;
+
+	// Where the scene is seen from and what surrounds it, used unless the command line says otherwise
+	Vec3f eye{};
+	double fov = ::fov;
+	std::string envmap = "envmap.jpg";
+
+	// Animation, a single still frame unless the scene file has keyframes
+	int frames = 1;
+	std::vector<Track> tracks;
+
+	// Moves the camera, the animated spheres and instances to where they are in 'frame'
+	struct Moved { bool spheres, instances; };
+	Moved animate(int frame)
+	{
+		Moved moved{};
+		for (const Track& track : tracks)
+		{
+			if (track.target == Track::camera)
+				eye = track.at(frame);
+			else if (track.target & Track::instance)
+			{
+				MeshInstance& instance = instances[track.target & ~Track::instance];
+				Vec3f position = track.at(frame);
+				if (position.x == instance.position.x && position.y == instance.position.y && position.z == instance.position.z)
+					continue;
+				instance.position = position;
+				instance.place(meshes[instance.mesh]);
+				moved.instances = true;
+			}
+			else
+			{
+				Vec3f& centre = spheres[track.target]->centre;
+				Vec3f position = track.at(frame);
+				moved.spheres |= position.x != centre.x || position.y != centre.y || position.z != centre.z;
+				centre = position;
+			}
+		}
+		return moved;
+	}
+
+	BVH bvh;
+	SphereSoA sphere_soa;	// what the rays actually test, in BVH leaf order
+
+	Scene() = default;
+	Scene(Scene&&) = default;
+	Scene& operator=(Scene&&) = default;
+
+	// Deep copy, the spheres and lights get allocations of their own. For experiments that edit a scene
+	// without touching the one being rendered
+	Scene(const Scene& o) : materials{ o.materials }, meshes{ o.meshes }, instances{ o.instances }, instance_bvh{ o.instance_bvh },
+		shapes{ o.shapes }, shape_bvh{ o.shape_bvh }, bounded_shapes{ o.bounded_shapes }, unbounded_shapes{ o.unbounded_shapes },
+		eye{ o.eye }, fov{ o.fov }, envmap{ o.envmap }, frames{ o.frames }, tracks{ o.tracks }, bvh{ o.bvh }, sphere_soa{ o.sphere_soa }
+	{
+		for (const auto& sphere : o.spheres)
+			spheres.push_back(std::make_unique<Sphere>(*sphere));
+		for (const auto& light : o.lights)
+			lights.push_back(std::make_unique<Light>(*light));
+	}
+
+	void build_bvh()
+	{
+		std::vector<AABB> bounds(spheres.size());
+		for (size_t i = 0; i < spheres.size(); ++i)
+			bounds[i] = spheres[i]->bounds();
+		// One SIMD batch per leaf
+		bvh.build(bounds, SphereSoA::lane_width > 4 ? SphereSoA::lane_width : 4);
+		sphere_soa.build(spheres, bvh.prim_indices);
+		build_instance_bvh();
+		build_shape_bvh();
+	}
+
+	void build_shape_bvh()
+	{
+		bounded_shapes.clear();
+		unbounded_shapes.clear();
+		std::vector<AABB> bounds;
+		for (size_t i = 0; i < shapes.size(); ++i)
+		{
+			if (!shapes[i].bounded())
+			{
+				unbounded_shapes.push_back(uint32_t(i));
+				continue;
+			}
+			bounded_shapes.push_back(uint32_t(i));
+			bounds.push_back(shapes[i].bounds());
+		}
+		shape_bvh.build(bounds);
+	}
+
+	// Closest shape in front of t_max, shrinks t_max. Only the distance, see resolve_hit for the rest
+	bool shape_hit(const Vec3f& orig, const Vec3f& dir, float& t_max, uint32_t& shape) const
+	{
+		bool hit = false;
+		auto test = [&](uint32_t id, float& t_closest) {
+			float t;
+			if (shapes[id].intersect(orig, dir, t) && t < t_closest)
+			{
+				t_closest = t;
+				shape = id;
+				hit = true;
+			}
+		};
+		shape_bvh.traverse(orig, dir, t_max, [&](uint32_t first, uint32_t count, float& t_closest) {
+			for (uint32_t i = first; i < first + count; ++i)
+				test(bounded_shapes[shape_bvh.prim_indices[i]], t_closest);
+		});
+		for (uint32_t id : unbounded_shapes)
+			test(id, t_max);
+		return hit;
+	}
+
+	bool shape_occluded(const Vec3f& orig, const Vec3f& dir, float t_max) const
+	{
+		auto blocks = [&](uint32_t id) {
+			float t;
+			return shapes[id].intersect(orig, dir, t) && t < t_max;
+		};
+		for (uint32_t id : unbounded_shapes)
+			if (blocks(id))
+				return true;
+		return shape_bvh.traverse_any(orig, dir, t_max, [&](uint32_t first, uint32_t count) {
+			for (uint32_t i = first; i < first + count; ++i)
+				if (blocks(bounded_shapes[shape_bvh.prim_indices[i]]))
+					return true;
+			return false;
+		});
+	}
+
+	// One instance per leaf, testing one means a transform and a walk of its mesh's BVH
+	void build_instance_bvh()
+	{
+		std::vector<AABB> bounds(instances.size());
+		for (size_t i = 0; i < instances.size(); ++i)
+			bounds[i] = instances[i].bounds;
+		instance_bvh.build(bounds, 1);
+	}
+
+	// Closest instance triangle in front of t_max, shrinks t_max. 'triangle' as TriangleMesh::closest_hit
+	bool instance_hit(const Vec3f& orig, const Vec3f& dir, float& t_max, uint32_t& instance, uint32_t& triangle) const
+	{
+		bool hit = false;
+		instance_bvh.traverse(orig, dir, t_max, [&](uint32_t first, uint32_t count, float& t_closest) {
+			for (uint32_t i = first; i < first + count; ++i)
+			{
+				uint32_t id = instance_bvh.prim_indices[i];
+				const MeshInstance& inst = instances[id];
+				if (inst.closest_hit(meshes[inst.mesh], orig, dir, t_closest, triangle))
+				{
+					instance = id;
+					hit = true;
+				}
+			}
+		});
+		return hit;
+	}
+
+	bool instance_occluded(const Vec3f& orig, const Vec3f& dir, float t_max) const
+	{
+		return instance_bvh.traverse_any(orig, dir, t_max, [&](uint32_t first, uint32_t count) {
+			for (uint32_t i = first; i < first + count; ++i)
+			{
+				const MeshInstance& inst = instances[instance_bvh.prim_indices[i]];
+				if (inst.any_hit(meshes[inst.mesh], orig, dir, t_max))
+					return true;
+			}
+			return false;
+		});
+	}
+
+	// Refits the BVH to spheres that moved, or builds it again once refitting has made it
+	// max_refit_cost times as expensive as the last build. True when it was rebuilt
+	static constexpr float max_refit_cost = 1.5f;
+	bool update_bvh()
+	{
+		std::vector<AABB> bounds(spheres.size());
+		for (size_t i = 0; i < spheres.size(); ++i)
+			bounds[i] = spheres[i]->bounds();
+		bvh.refit(bounds);
+		if (bvh.sah_cost() > max_refit_cost * bvh.build_cost)
+		{
+			build_bvh();
+			return true;
+		}
+		sphere_soa.refit(spheres);
+		return false;
+	}
+};
+
 #endif
\ No newline at end of file
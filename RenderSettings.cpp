@@ -0,0 +1,171 @@
+// RenderSettings.cpp : Command line parsing of the RenderSettings declared in RenderSettings.h
+//
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include "RayTracer.h"
+#include "RenderSettings.h"
+
+RenderSettings::RenderSettings() : width{ w_width }, height{ w_height }, envmap_cache{ EnvMap::default_cache_dir() },
+    termination{ default_termination }, min_contribution{ default_min_contribution } {}
+
+namespace
+{
+    // A whole argument as a number, nothing may follow it
+    bool parse_argument_number(const char* text, double& value)
+    {
+        char* end = nullptr;
+        value = std::strtod(text, &end);
+        return end != text && *end == '\0';
+    }
+
+    // Comma separated list of counts, "4,1024,65536"
+    bool parse_counts(const std::string& text, std::vector<int>& counts)
+    {
+        std::vector<int> parsed;
+        size_t start = 0;
+        while (start <= text.size())
+        {
+            size_t comma = std::min(text.find(',', start), text.size());
+            double n{};
+            if (!parse_argument_number(text.substr(start, comma - start).c_str(), n) || n < 1 || n > 1e8)
+                return false;
+            parsed.push_back(int(n));
+            start = comma + 1;
+        }
+        counts = parsed;
+        return true;
+    }
+}
+
+bool RenderSettings::parse(int argc, char** argv)
+{
+    for (int a = 1; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+        if (arg == "--help" || arg == "-h")
+        {
+            usage(argv[0]);
+            return false;
+        }
+        if (arg == "--bench" || arg == "--report")
+        {
+            (arg == "--bench" ? bench : report) = true;
+            continue;
+        }
+
+        // Both "--name value" and "--name=value"
+        std::string value;
+        size_t eq = arg.find('=');
+        if (eq != std::string::npos)
+        {
+            value = arg.substr(eq + 1);
+            arg.resize(eq);
+        }
+        else if (a + 1 < argc)
+            value = argv[++a];
+        else
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+
+        if (arg == "--out" || arg == "--scene" || arg == "--save-scene" || arg == "--bench-json")
+        {
+            (arg == "--out" ? out : arg == "--scene" ? scene : arg == "--save-scene" ? save_scene : bench_json) = value;
+            continue;
+        }
+        if (arg == "--envmap-cache")
+        {
+            envmap_cache = value == "none" ? std::string() : value;
+            continue;
+        }
+        if (arg == "--termination")
+        {
+            if (value == "exact") termination = Termination::Exact;
+            else if (value == "threshold") termination = Termination::Threshold;
+            else if (value == "roulette") termination = Termination::RussianRoulette;
+            else
+            {
+                std::cerr << "Expected exact, threshold or roulette for --termination: " << value << "\n";
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--bench-spheres" || arg == "--bench-lights")
+        {
+            if (!parse_counts(value, arg == "--bench-spheres" ? bench_spheres : bench_lights))
+            {
+                std::cerr << "Expected a list of counts for " << arg << ": " << value << "\n";
+                return false;
+            }
+            continue;
+        }
+
+        double number{};
+        if (!parse_argument_number(value.c_str(), number))
+        {
+            std::cerr << "Not a number for " << arg << ": " << value << "\n";
+            return false;
+        }
+
+        if (arg == "--width" && number >= 1 && number <= 65536) width = int(number);
+        else if (arg == "--height" && number >= 1 && number <= 65536) height = int(number);
+        else if (arg == "--fov" && number > 0 && number < 180) fov = number * pi / 180;
+        else if (arg == "--spp" && number >= 0 && number <= 65536) spp = int(number);
+        else if (arg == "--time" && number >= 0) time = number;
+        else if (arg == "--pass-spp" && number >= 1 && number <= 65536) pass_spp = int(number);
+        else if (arg == "--progress" && number >= 0 && number <= 1e6) progress = int(number);
+        else if (arg == "--noise" && number >= 0) noise = number;
+        else if (arg == "--min-spp" && number >= 2 && number <= 65536) min_spp = int(number);
+        else if (arg == "--threads" && number >= 0 && number <= 4096) threads = unsigned(number);
+        else if (arg == "--min-contribution" && number > 0 && number <= 1) min_contribution = float(number);
+        else if (arg == "--bench-reps" && number >= 1 && number <= 1000) bench_reps = int(number);
+        else
+        {
+            std::cerr << "Unknown option or value out of range: " << arg << " " << value << "\n";
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (spp == 0 && time <= 0)
+    {
+        std::cerr << "--spp 0 needs a --time budget\n";
+        return false;
+    }
+    return true;
+}
+
+void RenderSettings::usage(const char* program)
+{
+    RenderSettings defaults;
+    std::cout << "Usage: " << program << " [options]\n"
+        << "  --width N        image width in pixels (" << defaults.width << ")\n"
+        << "  --height N       image height in pixels (" << defaults.height << ")\n"
+        << "  --fov DEGREES    vertical field of view (the scene's, " << ::fov * 180 / pi << " for the demo)\n"
+        << "  --spp N          samples per pixel, 0 for as many as --time allows (" << defaults.spp << ")\n"
+        << "  --time SECONDS   stop before the pass that would take longer, 0 for no limit (" << defaults.time << ")\n"
+        << "  --pass-spp N     samples per pixel added by every progressive pass (" << defaults.pass_spp << ")\n"
+        << "  --progress N     write the image so far every N passes, 0 for only the final one (" << defaults.progress << ")\n"
+        << "  --noise LEVELS   adaptive sampling: stop a tile once no pixel's standard error is above this many\n"
+        << "                   8 bit levels, 0 for the same samples everywhere (" << defaults.noise << ")\n"
+        << "  --min-spp N      samples every tile gets before adaptive sampling can stop it (" << defaults.min_spp << ")\n"
+        << "  --threads N      worker threads, 0 for one per hardware thread (" << defaults.threads << ")\n"
+        << "  --out FILE       output image, .png or .ppm (" << defaults.out << ")\n"
+        << "  --termination exact|threshold|roulette  reflection and refraction rays that contribute less than\n"
+        << "                   --min-contribution: traced, dropped, or traced at random and weighted up (exact)\n"
+        << "  --min-contribution X       product of the albedos along a ray's path (" << defaults.min_contribution << ")\n"
+        << "  --scene FILE     scene to render, text or .rtscene (the built in demo)\n"
+        << "  --save-scene FILE.rtscene  write the scene in the binary format too\n"
+        << "  --envmap-cache DIR         where the converted environment map is cached, none for no cache\n"
+        << "                             (" << (defaults.envmap_cache.empty() ? "none" : defaults.envmap_cache) << ")\n"
+        << "  --report         time and compare the engines on the scene before rendering it\n"
+        << "  --bench          run the benchmark suite instead of rendering the scene\n"
+        << "  --bench-json FILE          benchmark results (" << defaults.bench_json << ")\n"
+        << "  --bench-spheres N,N,..     sphere counts of the generated benchmark scenes\n"
+        << "  --bench-lights N,N,..      light counts of the generated benchmark scenes\n"
+        << "  --bench-reps N   timed repetitions of every benchmark (" << defaults.bench_reps << ")\n";
+}
@@ -0,0 +1,53 @@
+#ifndef RENDERSETTINGS_H
+#define RENDERSETTINGS_H
+
+#include <string>
+#include <vector>
+
+enum class Termination;
+
+// Everything about a frame that can change without a recompile, filled from the command line:
+//   --width N  --height N  --fov DEGREES  --spp N  --threads N  --out FILE (.ppm or .png)
+//   --time SECONDS  --pass-spp N  --progress N  --noise LEVELS  --min-spp N  (progressive and adaptive
+//   rendering, see render_progressive)
+//   --scene FILE (see SceneFile.h)  --save-scene FILE.rtscene  --envmap-cache DIR|none (see EnvMap.h)
+//   --termination exact|threshold|roulette  --min-contribution X  (see Termination in RayTracer.h)
+//   --report  (timing and comparison passes before the render, see the report_ functions in RayTracer.h)
+//   --bench  --bench-json FILE  --bench-spheres N,N,..  --bench-lights N,N,..  --bench-reps N  (see Bench.h)
+// The defaults render the frame the compile time constants in RayTracer.h describe
+struct RenderSettings
+{
+	int width;
+	int height;
+	double fov = 0;			// vertical, in radians. 0 : the scene's
+	int spp = 1;			// samples per pixel, 0 : as many as the time budget allows
+	double time = 0;		// time budget in seconds, 0 : none
+	int pass_spp = 1;		// samples per pixel of one progressive pass
+	int progress = 0;		// write the image so far every this many passes, 0 : only at the end
+	double noise = 0;		// adaptive sampling target, standard error of a pixel in 8 bit levels. 0 : off
+	int min_spp = 8;		// samples every tile gets before adaptive sampling may stop it
+	unsigned threads = 0;	// 0 : one per hardware thread
+	std::string out = "Raytracer.ppm";
+	std::string scene;		// empty : the built in demo scene
+	std::string save_scene;	// binary copy of the loaded scene to write before rendering
+	std::string envmap_cache;	// directory of the cube map cache, empty : no cache
+	Termination termination;	// of reflection and refraction rays that contribute little
+	float min_contribution;		// below this a ray counts as contributing little
+
+	bool report = false;	// print the report_ passes, each traces the scene again on top of the render
+
+	// Benchmark suite instead of a frame
+	bool bench = false;
+	std::string bench_json = "bench.json";
+	std::vector<int> bench_spheres = { 4, 1024, 65536 };
+	std::vector<int> bench_lights = { 1, 3, 8 };
+	int bench_reps = 5;
+
+	RenderSettings();
+
+	// false when the arguments are wrong or --help was asked for, the reason or the usage is printed then
+	bool parse(int argc, char** argv);
+	static void usage(const char* program);
+};
+
+#endif
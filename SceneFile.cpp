@@ -0,0 +1,804 @@
+// SceneFile.cpp : Text and binary scene loaders and the binary writer declared in SceneFile.h
+//
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include "RayTracer.h"
+#include "SceneFile.h"
+#include "MeshFile.h"
+
+bool parse_number(const char*& p, const char* end, double& out)
+{
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const char* q = p;
+    bool negative = false;
+    if (q < end && (*q == '-' || *q == '+'))
+        negative = *q++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; q < end && *q >= '0' && *q <= '9'; ++q, any = true)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*q - '0');
+            digits += mantissa != 0;
+        }
+        else
+            ++exponent;
+    }
+    if (q < end && *q == '.')
+    {
+        for (++q; q < end && *q >= '0' && *q <= '9'; ++q, any = true)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*q - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any) return false;
+
+    if (q < end && (*q == 'e' || *q == 'E'))
+    {
+        ++q;
+        bool negative_exp = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negative_exp = *q++ == '-';
+        if (q == end || *q < '0' || *q > '9') return false;
+        int e = 0;
+        for (; q < end && *q >= '0' && *q <= '9'; ++q)
+            e = std::min(e * 10 + (*q - '0'), 10000);
+        exponent += negative_exp ? -e : e;
+    }
+
+    double v = double(mantissa);
+    if (exponent < 0)
+        v = -exponent <= 22 ? v / powers[-exponent] : v * std::pow(10., exponent);
+    else if (exponent > 0)
+        v = exponent <= 22 ? v * powers[exponent] : v * std::pow(10., exponent);
+    out = negative ? -v : v;
+    p = q;
+    return true;
+}
+
+namespace
+{
+    // Records as they sit in the binary file, and as the text parser collects them
+    struct MaterialRecord { float albedo[4], diffuse[3], sp_exp, refractive_index; };
+    struct SphereRecord { float centre[3], radius; uint32_t material; };
+    struct LightRecord { float position[3], intensity; };
+    struct PlaneRecord { float height, x_min, x_max, z_min, z_max, colour_a[3], colour_b[3]; };	// text only, saved as a box shape
+    struct KeyRecord { uint32_t target, frame; float position[3]; };	// target as Track::target
+    struct MeshRecord { float offset[3], scale; uint32_t material, name_length; };	// the names follow the envmap's
+    struct InstanceRecord { uint32_t mesh, material; float position[3], scale, rotation; };
+    struct ShapeRecord { uint32_t kind, material; float a[3], b[3], radius; uint32_t texture; float colour_a[3], colour_b[3], texture_size; };	// as Shape
+
+    static_assert(sizeof(SceneHeader) == 72, "SceneHeader must have no padding");
+    static_assert(sizeof(MaterialRecord) == 36 && sizeof(SphereRecord) == 20 && sizeof(LightRecord) == 16
+        && sizeof(KeyRecord) == 20 && sizeof(MeshRecord) == 24
+        && sizeof(InstanceRecord) == 28 && sizeof(ShapeRecord) == 68, "scene records must have no padding");
+
+    constexpr size_t spheres_per_task = 1 << 16;
+
+    Material to_material(const MaterialRecord& r)
+    {
+        return Material(Vec4f(r.albedo[0], r.albedo[1], r.albedo[2], r.albedo[3]), Vec3f(r.diffuse[0], r.diffuse[1], r.diffuse[2]), r.sp_exp, r.refractive_index);
+    }
+
+    // The checkerboard of a plane record, a box with no height and no material
+    Shape to_board(const PlaneRecord& r)
+    {
+        return Shape::box(Vec3f(r.x_min, r.height, r.z_min), Vec3f(r.x_max, r.height, r.z_max), Scene::no_material,
+            Texture::checker(Vec3f(r.colour_a[0], r.colour_a[1], r.colour_a[2]), Vec3f(r.colour_b[0], r.colour_b[1], r.colour_b[2])));
+    }
+
+    Shape to_shape(const ShapeRecord& r)
+    {
+        Vec3f a(r.a[0], r.a[1], r.a[2]), b(r.b[0], r.b[1], r.b[2]);
+        Texture texture;
+        if (Texture::Kind(r.texture) == Texture::Kind::Checker)
+            texture = Texture::checker(Vec3f(r.colour_a[0], r.colour_a[1], r.colour_a[2]), Vec3f(r.colour_b[0], r.colour_b[1], r.colour_b[2]), r.texture_size);
+        switch (Shape::Kind(r.kind))
+        {
+        case Shape::Kind::Box: return Shape::box(a, b, r.material, texture);
+        case Shape::Kind::Disc: return Shape::disc(a, b, r.radius, r.material, texture);
+        default: return Shape::plane(a, b, r.material, texture);
+        }
+    }
+
+    ShapeRecord to_record(const Shape& s)
+    {
+        const Texture& t = s.texture;
+        return ShapeRecord{ uint32_t(s.kind), s.material, { s.a.x, s.a.y, s.a.z }, { s.b.x, s.b.y, s.b.z }, s.radius, uint32_t(t.kind),
+            { t.colour_a.x, t.colour_a.y, t.colour_a.z }, { t.colour_b.x, t.colour_b.y, t.colour_b.z }, t.size };
+    }
+
+    bool valid(const ShapeRecord& r, size_t material_count)
+    {
+        bool flat = Shape::Kind(r.kind) != Shape::Kind::Box;
+        return r.kind <= uint32_t(Shape::Kind::Disc) && (r.material < material_count || r.material == Scene::no_material)
+            && r.texture <= uint32_t(Texture::Kind::Checker) && (r.texture == 0 || r.texture_size > 0.f)
+            && (!flat || r.b[0] != 0.f || r.b[1] != 0.f || r.b[2] != 0.f);
+    }
+
+    // Groups the keyframes into one Track per target, in the order the targets first appear. 'frames' 0 means up to
+    // the last keyframe
+    bool fill_animation(const char* filename, Scene& scene, const KeyRecord* keys, size_t key_count, uint32_t frames)
+    {
+        std::unordered_map<uint32_t, size_t> track_of;
+        uint32_t last = 0;
+        for (size_t i = 0; i < key_count; ++i)
+        {
+            const KeyRecord& k = keys[i];
+            if (k.target != Track::camera && (k.target & Track::instance) && (k.target & ~Track::instance) >= scene.instances.size())
+            {
+                std::cerr << "Error: " << filename << ": keyframe for instance " << (k.target & ~Track::instance) << " of " << scene.instances.size() << std::endl;
+                return false;
+            }
+            if (!(k.target & Track::instance) && k.target >= scene.spheres.size())
+            {
+                std::cerr << "Error: " << filename << ": keyframe for sphere " << k.target << " of " << scene.spheres.size() << std::endl;
+                return false;
+            }
+            auto found = track_of.emplace(k.target, scene.tracks.size());
+            if (found.second)
+            {
+                scene.tracks.emplace_back();
+                scene.tracks.back().target = k.target;
+            }
+            scene.tracks[found.first->second].keys.push_back(Keyframe{ int(k.frame), Vec3f(k.position[0], k.position[1], k.position[2]) });
+            last = std::max(last, k.frame);
+        }
+
+        for (Track& track : scene.tracks)
+            std::stable_sort(track.keys.begin(), track.keys.end(), [](const Keyframe& a, const Keyframe& b) { return a.frame < b.frame; });
+        scene.frames = frames ? int(frames) : key_count ? int(last) + 1 : 1;
+        return true;
+    }
+
+    // Turns the records into the scene's objects, the spheres (one allocation each) on the pool
+    bool fill_scene(const char* filename, Scene& scene, ThreadPool& pool, const MaterialRecord* materials, size_t material_count,
+        const SphereRecord* spheres, size_t sphere_count, const LightRecord* lights, size_t light_count, const PlaneRecord* planes, size_t plane_count,
+        const KeyRecord* keys, size_t key_count, uint32_t frames, const MeshRecord* meshes, size_t mesh_count, const std::vector<std::string>& mesh_names,
+        const InstanceRecord* instances, size_t instance_count, const ShapeRecord* shapes, size_t shape_count)
+    {
+        scene.materials.reserve(material_count);
+        for (size_t i = 0; i < material_count; ++i)
+            scene.materials.push_back(to_material(materials[i]));
+
+        for (size_t i = 0; i < sphere_count; ++i)
+        {
+            if (spheres[i].material >= material_count)
+            {
+                std::cerr << "Error: " << filename << ": sphere " << i << " uses material " << spheres[i].material << " of " << material_count << std::endl;
+                return false;
+            }
+        }
+
+        scene.spheres.resize(sphere_count);
+        pool.parallel_for((sphere_count + spheres_per_task - 1) / spheres_per_task, [&](size_t task, unsigned) {
+            size_t end = std::min(sphere_count, (task + 1) * spheres_per_task);
+            for (size_t i = task * spheres_per_task; i < end; ++i)
+            {
+                const SphereRecord& s = spheres[i];
+                scene.spheres[i] = std::make_unique<Sphere>(Vec3f(s.centre[0], s.centre[1], s.centre[2]), s.radius, s.material);
+            }
+        });
+
+        for (size_t i = 0; i < light_count; ++i)
+            scene.lights.push_back(std::make_unique<Light>(Vec3f(lights[i].position[0], lights[i].position[1], lights[i].position[2]), lights[i].intensity));
+        for (size_t i = 0; i < plane_count; ++i)
+            scene.shapes.push_back(to_board(planes[i]));
+        for (size_t i = 0; i < shape_count; ++i)
+        {
+            if (!valid(shapes[i], material_count))
+            {
+                std::cerr << "Error: " << filename << ": shape " << i << " is not a plane, box or disc with a known material and texture" << std::endl;
+                return false;
+            }
+            scene.shapes.push_back(to_shape(shapes[i]));
+        }
+
+        // Every mesh record loads its mesh and places it once, as the instance with its own number
+        scene.meshes.resize(mesh_count);
+        scene.instances.resize(mesh_count + instance_count);
+        for (size_t i = 0; i < mesh_count; ++i)
+        {
+            const MeshRecord& r = meshes[i];
+            if (r.material >= material_count)
+            {
+                std::cerr << "Error: " << filename << ": mesh " << i << " uses material " << r.material << " of " << material_count << std::endl;
+                return false;
+            }
+            TriangleMesh& mesh = scene.meshes[i];
+            if (!load_mesh(mesh_names[i].c_str(), pool, mesh))
+                return false;
+            mesh.source = mesh_names[i];
+            mesh.build();
+            std::cout << "Mesh BVH: " << mesh.bvh.nodes.size() << " nodes, " << mesh.bvh.leaf_count << " leaves, max depth " << mesh.bvh.max_depth
+                << ", built in " << mesh.bvh.build_ms << " ms" << std::endl;
+
+            MeshInstance& instance = scene.instances[i];
+            instance.mesh = uint32_t(i);
+            instance.material = r.material;
+            instance.position = Vec3f(r.offset[0], r.offset[1], r.offset[2]);
+            instance.scale = r.scale;
+            instance.place(mesh);
+        }
+        for (size_t i = 0; i < instance_count; ++i)
+        {
+            const InstanceRecord& r = instances[i];
+            if (r.mesh >= mesh_count || r.material >= material_count)
+            {
+                std::cerr << "Error: " << filename << ": instance " << mesh_count + i << " uses mesh " << r.mesh << " of " << mesh_count
+                    << " and material " << r.material << " of " << material_count << std::endl;
+                return false;
+            }
+            MeshInstance& instance = scene.instances[mesh_count + i];
+            instance.mesh = r.mesh;
+            instance.material = r.material;
+            instance.position = Vec3f(r.position[0], r.position[1], r.position[2]);
+            instance.scale = r.scale;
+            instance.rotation = r.rotation;
+            instance.place(scene.meshes[r.mesh]);
+        }
+        return fill_animation(filename, scene, keys, key_count, frames);
+    }
+
+    // ******************** Text ********************
+
+    // Everything one chunk of the text contributes, merged in file order afterwards
+    struct Chunk
+    {
+        const char* begin{}, * end{};
+        size_t lines{};
+
+        std::vector<MaterialRecord> materials;
+        std::vector<std::string> material_names;
+        std::vector<SphereRecord> spheres;
+        std::vector<LightRecord> lights;
+        std::vector<PlaneRecord> planes;
+        std::vector<KeyRecord> keys;
+        std::vector<MeshRecord> meshes;
+        std::vector<std::string> mesh_names;
+        std::vector<InstanceRecord> instances;
+        std::vector<ShapeRecord> shapes;
+
+        // Material names used by this chunk's spheres, meshes, instances and shapes, which refer to them with named_ref set
+        static constexpr uint32_t named_ref = 0x80000000u;
+        std::vector<std::string> refs;
+        std::unordered_map<std::string, uint32_t> ref_ids;
+
+        bool has_camera{}, has_envmap{};
+        uint32_t frames{};		// 0 : no frames record
+        float eye[3]{};
+        double fov{};
+        std::string envmap;
+
+        std::string error;
+        size_t error_line{};	// 1 based within the chunk
+
+        void parse();
+
+    private:
+        const char* p{};
+        const char* line_end{};
+
+        void skip_space() { while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p; }
+        bool at_end() { skip_space(); return p == line_end || *p == '#'; }
+
+        std::string word()
+        {
+            skip_space();
+            const char* start = p;
+            while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') ++p;
+            return std::string(start, p);
+        }
+
+        bool number(float& f)
+        {
+            skip_space();
+            double v;
+            if (!parse_number(p, line_end, v)) return false;
+            if (p < line_end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') return false;
+            f = float(v);
+            return true;
+        }
+
+        bool whole_number(uint32_t& n)
+        {
+            skip_space();
+            double v;
+            if (!parse_number(p, line_end, v) || v < 0 || v > 1e9 || v != std::floor(v)) return false;
+            if (p < line_end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') return false;
+            n = uint32_t(v);
+            return true;
+        }
+
+        bool numbers(float* f, int n)
+        {
+            for (int i = 0; i < n; ++i)
+                if (!number(f[i])) return false;
+            return true;
+        }
+
+        // Material index, or a name to resolve once every chunk is parsed. "none" where Scene::no_material is allowed
+        bool material_ref(uint32_t& material, bool allow_none = false)
+        {
+            std::string ref = word();
+            if (ref.empty()) return false;
+            if (allow_none && ref == "none")
+                material = Scene::no_material;
+            else if (ref.find_first_not_of("0123456789") == std::string::npos && ref.size() < 10)
+                material = uint32_t(std::stoul(ref));
+            else
+            {
+                auto found = ref_ids.emplace(ref, uint32_t(refs.size()));
+                if (found.second) refs.push_back(ref);
+                material = found.first->second | named_ref;
+            }
+            return true;
+        }
+
+        bool parse_line();
+    };
+
+    void Chunk::parse()
+    {
+        for (const char* line = begin; line < end; ++lines)
+        {
+            line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+            if (!line_end) line_end = end;
+            p = line;
+            if (!at_end() && !parse_line())
+            {
+                if (error.empty()) error = "malformed record";
+                error_line = lines + 1;
+                return;
+            }
+            line = line_end + 1;
+        }
+    }
+
+    bool Chunk::parse_line()
+    {
+        std::string keyword = word();
+        if (keyword == "material")
+        {
+            MaterialRecord m;
+            std::string name = word();
+            if (name.empty() || !numbers(m.albedo, 4) || !numbers(m.diffuse, 3) || !number(m.sp_exp) || !number(m.refractive_index))
+                return false;
+            materials.push_back(m);
+            material_names.push_back(name);
+        }
+        else if (keyword == "sphere")
+        {
+            SphereRecord s;
+            if (!numbers(s.centre, 3) || !number(s.radius) || !material_ref(s.material)) return false;
+            spheres.push_back(s);
+        }
+        else if (keyword == "light")
+        {
+            LightRecord l;
+            if (!numbers(l.position, 3) || !number(l.intensity)) return false;
+            lights.push_back(l);
+        }
+        else if (keyword == "plane")
+        {
+            PlaneRecord b;
+            if (!number(b.height) || !number(b.x_min) || !number(b.x_max) || !number(b.z_min) || !number(b.z_max)
+                || !numbers(b.colour_a, 3) || !numbers(b.colour_b, 3))
+                return false;
+            planes.push_back(b);
+        }
+        else if (keyword == "shape")
+        {
+            ShapeRecord r{};
+            std::string kind = word();
+            if (kind == "plane" || kind == "disc")
+            {
+                r.kind = uint32_t(kind == "plane" ? Shape::Kind::Plane : Shape::Kind::Disc);
+                if (!numbers(r.a, 3) || !numbers(r.b, 3) || (kind == "disc" && !number(r.radius))) return false;
+            }
+            else if (kind == "box")
+            {
+                r.kind = uint32_t(Shape::Kind::Box);
+                if (!numbers(r.a, 3) || !numbers(r.b, 3)) return false;
+            }
+            else
+                return false;
+            if (!material_ref(r.material, true)) return false;
+            if (!at_end())
+            {
+                if (word() != "checker" || !numbers(r.colour_a, 3) || !numbers(r.colour_b, 3)) return false;
+                r.texture = uint32_t(Texture::Kind::Checker);
+                r.texture_size = 1.f;
+                if (!at_end() && !number(r.texture_size)) return false;
+            }
+            shapes.push_back(r);
+        }
+        else if (keyword == "mesh")
+        {
+            MeshRecord m{};
+            m.scale = 1.f;
+            std::string name = word();
+            if (name.empty() || !material_ref(m.material)) return false;
+            if (!at_end() && !numbers(m.offset, 3)) return false;
+            if (!at_end() && !number(m.scale)) return false;
+            m.name_length = uint32_t(name.size());
+            meshes.push_back(m);
+            mesh_names.push_back(name);
+        }
+        else if (keyword == "instance")
+        {
+            InstanceRecord r{};
+            r.scale = 1.f;
+            if (!whole_number(r.mesh) || !material_ref(r.material) || !numbers(r.position, 3)) return false;
+            if (!at_end() && !number(r.scale)) return false;
+            if (!at_end() && !number(r.rotation)) return false;
+            instances.push_back(r);
+        }
+        else if (keyword == "camera")
+        {
+            float degrees;
+            if (!numbers(eye, 3) || !number(degrees)) return false;
+            if (!(degrees > 0 && degrees < 180))
+            {
+                error = "field of view must be between 0 and 180 degrees";
+                return false;
+            }
+            fov = degrees * pi / 180;
+            has_camera = true;
+        }
+        else if (keyword == "envmap")
+        {
+            envmap = word();
+            if (envmap.empty()) return false;
+            has_envmap = true;
+        }
+        else if (keyword == "frames")
+        {
+            if (!whole_number(frames) || frames == 0) return false;
+        }
+        else if (keyword == "key")
+        {
+            KeyRecord k;
+            std::string target = word();
+            if (target == "camera")
+                k.target = Track::camera;
+            else if (target == "instance")
+            {
+                if (!whole_number(k.target) || (k.target & Track::instance)) return false;
+                k.target |= Track::instance;
+            }
+            else if (target != "sphere" || !whole_number(k.target) || (k.target & Track::instance))
+                return false;
+            if (!whole_number(k.frame) || !numbers(k.position, 3)) return false;
+            keys.push_back(k);
+        }
+        else
+        {
+            error = "unknown record '" + keyword + "'";
+            return false;
+        }
+
+        if (!at_end())
+        {
+            error = "unexpected '" + word() + "'";
+            return false;
+        }
+        return true;
+    }
+
+    bool load_text(const char* filename, const MappedFile& file, ThreadPool& pool, Scene& scene)
+    {
+        const char* text = reinterpret_cast<const char*>(file.data());
+        size_t size = file.size();
+
+        // Chunks of at least 64 KB, a few per worker so uneven lines still balance
+        size_t count = std::max<size_t>(1, std::min<size_t>(size / (64 << 10), size_t(pool.size()) * 4));
+        std::vector<Chunk> chunks(count);
+        const char* start = text;
+        for (size_t c = 0; c < count; ++c)
+        {
+            const char* stop = text + size * (c + 1) / count;
+            if (c + 1 == count)
+                stop = text + size;
+            else if (stop < start)
+                stop = start;
+            else
+            {
+                const char* nl = static_cast<const char*>(std::memchr(stop, '\n', text + size - stop));
+                stop = nl ? nl + 1 : text + size;
+            }
+            chunks[c].begin = start;
+            chunks[c].end = stop;
+            start = stop;
+        }
+
+        pool.parallel_for(count, [&](size_t c, unsigned) { chunks[c].parse(); });
+
+        size_t line_base = 0;
+        for (const Chunk& c : chunks)
+        {
+            if (!c.error.empty())
+            {
+                std::cerr << "Error: " << filename << ":" << line_base + c.error_line << ": " << c.error << std::endl;
+                return false;
+            }
+            line_base += c.lines;
+        }
+
+        // Materials are numbered across the whole file, then every chunk's names are resolved against them
+        std::vector<MaterialRecord> materials;
+        std::unordered_map<std::string, uint32_t> material_ids;
+        for (const Chunk& c : chunks)
+        {
+            for (size_t i = 0; i < c.materials.size(); ++i)
+            {
+                if (!material_ids.emplace(c.material_names[i], uint32_t(materials.size())).second)
+                {
+                    std::cerr << "Error: " << filename << ": material '" << c.material_names[i] << "' is defined twice" << std::endl;
+                    return false;
+                }
+                materials.push_back(c.materials[i]);
+            }
+        }
+
+        std::vector<size_t> sphere_base(count + 1);
+        for (size_t c = 0; c < count; ++c)
+            sphere_base[c + 1] = sphere_base[c] + chunks[c].spheres.size();
+        std::vector<SphereRecord> spheres(sphere_base[count]);
+
+        std::vector<LightRecord> lights;
+        std::vector<PlaneRecord> planes;
+        std::vector<KeyRecord> keys;
+        std::vector<MeshRecord> meshes;
+        std::vector<std::string> mesh_names;
+        std::vector<InstanceRecord> instances;
+        std::vector<ShapeRecord> shapes;
+        uint32_t frames = 0;
+        for (size_t c = 0; c < count; ++c)
+        {
+            Chunk& chunk = chunks[c];
+            std::vector<uint32_t> resolved(chunk.refs.size());
+            for (size_t r = 0; r < chunk.refs.size(); ++r)
+            {
+                auto found = material_ids.find(chunk.refs[r]);
+                if (found == material_ids.end())
+                {
+                    std::cerr << "Error: " << filename << ": unknown material '" << chunk.refs[r] << "'" << std::endl;
+                    return false;
+                }
+                resolved[r] = found->second;
+            }
+            for (SphereRecord& s : chunk.spheres)
+                if (s.material & Chunk::named_ref)
+                    s.material = resolved[s.material & ~Chunk::named_ref];
+            std::copy(chunk.spheres.begin(), chunk.spheres.end(), spheres.begin() + sphere_base[c]);
+            for (MeshRecord& m : chunk.meshes)
+                if (m.material & Chunk::named_ref)
+                    m.material = resolved[m.material & ~Chunk::named_ref];
+            meshes.insert(meshes.end(), chunk.meshes.begin(), chunk.meshes.end());
+            mesh_names.insert(mesh_names.end(), chunk.mesh_names.begin(), chunk.mesh_names.end());
+            for (InstanceRecord& r : chunk.instances)
+                if (r.material & Chunk::named_ref)
+                    r.material = resolved[r.material & ~Chunk::named_ref];
+            instances.insert(instances.end(), chunk.instances.begin(), chunk.instances.end());
+            for (ShapeRecord& r : chunk.shapes)
+                if (r.material != Scene::no_material && (r.material & Chunk::named_ref))
+                    r.material = resolved[r.material & ~Chunk::named_ref];
+            shapes.insert(shapes.end(), chunk.shapes.begin(), chunk.shapes.end());
+
+            lights.insert(lights.end(), chunk.lights.begin(), chunk.lights.end());
+            planes.insert(planes.end(), chunk.planes.begin(), chunk.planes.end());
+            keys.insert(keys.end(), chunk.keys.begin(), chunk.keys.end());
+            if (chunk.frames)
+                frames = chunk.frames;
+            if (chunk.has_camera)
+            {
+                scene.eye = Vec3f(chunk.eye[0], chunk.eye[1], chunk.eye[2]);
+                scene.fov = chunk.fov;
+            }
+            if (chunk.has_envmap)
+                scene.envmap = chunk.envmap;
+        }
+
+        return fill_scene(filename, scene, pool, materials.data(), materials.size(), spheres.data(), spheres.size(),
+            lights.data(), lights.size(), planes.data(), planes.size(), keys.data(), keys.size(), frames, meshes.data(), meshes.size(), mesh_names,
+            instances.data(), instances.size(), shapes.data(), shapes.size());
+    }
+
+    // ******************** Binary ********************
+
+    bool load_binary(const char* filename, const MappedFile& file, ThreadPool& pool, Scene& scene)
+    {
+        SceneHeader header;
+        if (file.size() < sizeof(header))
+        {
+            std::cerr << "Error: " << filename << " is not a scene file" << std::endl;
+            return false;
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, scene_magic, sizeof(scene_magic)) != 0 || header.version != scene_version)
+        {
+            std::cerr << "Error: " << filename << " is not a version " << scene_version << " scene file" << std::endl;
+            return false;
+        }
+
+        uint64_t expected = sizeof(header) + uint64_t(header.material_count) * sizeof(MaterialRecord) + uint64_t(header.sphere_count) * sizeof(SphereRecord)
+            + uint64_t(header.light_count) * sizeof(LightRecord) + uint64_t(header.key_count) * sizeof(KeyRecord) + uint64_t(header.mesh_count) * sizeof(MeshRecord)
+            + uint64_t(header.instance_count) * sizeof(InstanceRecord) + uint64_t(header.shape_count) * sizeof(ShapeRecord) + header.envmap_length + header.mesh_names_length;
+        if (file.size() != expected)
+        {
+            std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+            return false;
+        }
+
+        // Every record is a multiple of 4 bytes and the mapping is page aligned, so they are read in place
+        const uint8_t* p = file.data() + sizeof(header);
+        auto materials = reinterpret_cast<const MaterialRecord*>(p);
+        p += header.material_count * sizeof(MaterialRecord);
+        auto spheres = reinterpret_cast<const SphereRecord*>(p);
+        p += header.sphere_count * sizeof(SphereRecord);
+        auto lights = reinterpret_cast<const LightRecord*>(p);
+        p += header.light_count * sizeof(LightRecord);
+        auto keys = reinterpret_cast<const KeyRecord*>(p);
+        p += header.key_count * sizeof(KeyRecord);
+        auto meshes = reinterpret_cast<const MeshRecord*>(p);
+        p += header.mesh_count * sizeof(MeshRecord);
+        auto instances = reinterpret_cast<const InstanceRecord*>(p);
+        p += header.instance_count * sizeof(InstanceRecord);
+        auto shapes = reinterpret_cast<const ShapeRecord*>(p);
+        p += header.shape_count * sizeof(ShapeRecord);
+
+        scene.eye = Vec3f(header.eye[0], header.eye[1], header.eye[2]);
+        scene.fov = header.fov;
+        if (header.envmap_length)
+            scene.envmap.assign(reinterpret_cast<const char*>(p), header.envmap_length);
+        p += header.envmap_length;
+
+        std::vector<std::string> mesh_names(header.mesh_count);
+        uint64_t names_left = header.mesh_names_length;
+        for (uint32_t i = 0; i < header.mesh_count; ++i)
+        {
+            if (meshes[i].name_length > names_left)
+            {
+                std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+                return false;
+            }
+            mesh_names[i].assign(reinterpret_cast<const char*>(p), meshes[i].name_length);
+            p += meshes[i].name_length;
+            names_left -= meshes[i].name_length;
+        }
+
+        return fill_scene(filename, scene, pool, materials, header.material_count, spheres, header.sphere_count,
+            lights, header.light_count, nullptr, 0, keys, header.key_count, header.frames, meshes, header.mesh_count, mesh_names,
+            instances, header.instance_count, shapes, header.shape_count);
+    }
+
+    bool is_binary_name(const char* filename)
+    {
+        size_t len = std::strlen(filename);
+        return len >= 8 && std::strcmp(filename + len - 8, ".rtscene") == 0;
+    }
+}
+
+bool load_scene(const char* filename, ThreadPool& pool, Scene& scene)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    scene.materials.clear();
+    scene.spheres.clear();
+    scene.lights.clear();
+    scene.shapes.clear();
+    scene.meshes.clear();
+    scene.instances.clear();
+    scene.eye = Vec3f(0.f, 0.f, 0.f);
+    scene.fov = fov;
+    scene.envmap = "envmap.jpg";
+    scene.frames = 1;
+    scene.tracks.clear();
+
+    MappedFile file;
+    if (!file.open(filename))
+    {
+        std::cerr << "Error: can not open the scene " << filename << std::endl;
+        return false;
+    }
+
+    bool ok = is_binary_name(filename) ? load_binary(filename, file, pool, scene) : load_text(filename, file, pool, scene);
+    if (ok)
+        std::cout << "Scene: " << filename << ", " << scene.spheres.size() << " spheres, " << scene.lights.size() << " lights, "
+            << scene.shapes.size() << " shapes, " << scene.meshes.size() << " meshes, "
+            << scene.instances.size() << " instances, " << scene.frames << (scene.frames == 1 ? " frame" : " frames") << ", loaded in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+    return ok;
+}
+
+bool save_scene(const char* filename, const Scene& scene)
+{
+    std::vector<MaterialRecord> materials;
+    for (const Material& m : scene.materials)
+        materials.push_back(MaterialRecord{ { m.albedo.x, m.albedo.y, m.albedo.z, m.albedo.w },
+            { m.diffuse_color.x, m.diffuse_color.y, m.diffuse_color.z }, m.sp_exp, m.refractive_index });
+    std::vector<SphereRecord> spheres;
+    spheres.reserve(scene.spheres.size());
+    for (const auto& s : scene.spheres)
+        spheres.push_back(SphereRecord{ { s->centre.x, s->centre.y, s->centre.z }, s->radius, s->material });
+
+    std::vector<LightRecord> lights;
+    for (const auto& l : scene.lights)
+        lights.push_back(LightRecord{ { l->position.x, l->position.y, l->position.z }, l->intensity });
+    std::vector<ShapeRecord> shapes;
+    for (const Shape& b : scene.shapes)
+        shapes.push_back(to_record(b));
+    std::vector<KeyRecord> keys;
+    for (const Track& track : scene.tracks)
+        for (const Keyframe& k : track.keys)
+            keys.push_back(KeyRecord{ track.target, uint32_t(k.frame), { k.position.x, k.position.y, k.position.z } });
+    std::vector<MeshRecord> meshes;
+    std::string mesh_names;
+    for (size_t i = 0; i < scene.meshes.size(); ++i)
+    {
+        const MeshInstance& placed = scene.instances[i];
+        meshes.push_back(MeshRecord{ { placed.position.x, placed.position.y, placed.position.z }, placed.scale, placed.material,
+            uint32_t(scene.meshes[i].source.size()) });
+        mesh_names += scene.meshes[i].source;
+    }
+    std::vector<InstanceRecord> instances;
+    for (size_t i = scene.meshes.size(); i < scene.instances.size(); ++i)
+    {
+        const MeshInstance& m = scene.instances[i];
+        instances.push_back(InstanceRecord{ m.mesh, m.material, { m.position.x, m.position.y, m.position.z }, m.scale, m.rotation });
+    }
+
+    SceneHeader header{};
+    std::memcpy(header.magic, scene_magic, sizeof(scene_magic));
+    header.version = scene_version;
+    header.material_count = uint32_t(materials.size());
+    header.sphere_count = uint32_t(spheres.size());
+    header.light_count = uint32_t(lights.size());
+    header.shape_count = uint32_t(shapes.size());
+    header.key_count = uint32_t(keys.size());
+    header.frames = uint32_t(scene.frames);
+    header.mesh_count = uint32_t(meshes.size());
+    header.mesh_names_length = uint32_t(mesh_names.size());
+    header.instance_count = uint32_t(instances.size());
+    header.envmap_length = uint32_t(scene.envmap.size());
+    header.eye[0] = scene.eye.x;
+    header.eye[1] = scene.eye.y;
+    header.eye[2] = scene.eye.z;
+    header.fov = scene.fov;
+
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(materials.data()), materials.size() * sizeof(MaterialRecord));
+    out.write(reinterpret_cast<const char*>(spheres.data()), spheres.size() * sizeof(SphereRecord));
+    out.write(reinterpret_cast<const char*>(lights.data()), lights.size() * sizeof(LightRecord));
+    out.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(KeyRecord));
+    out.write(reinterpret_cast<const char*>(meshes.data()), meshes.size() * sizeof(MeshRecord));
+    out.write(reinterpret_cast<const char*>(instances.data()), instances.size() * sizeof(InstanceRecord));
+    out.write(reinterpret_cast<const char*>(shapes.data()), shapes.size() * sizeof(ShapeRecord));
+    out.write(scene.envmap.data(), scene.envmap.size());
+    out.write(mesh_names.data(), mesh_names.size());
+    out.close();
+    if (!out)
+    {
+        std::cerr << "Error: can not write the scene " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
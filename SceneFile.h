@@ -0,0 +1,66 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <cstdint>
+
+struct Scene;
+class ThreadPool;
+
+// Scene files, as text for authoring and as a compact binary form for loading large scenes fast.
+//
+// Text (any extension but .rtscene), one record per line, '#' starts a comment:
+//   material <name> <albedo: diffuse specular reflect refract> <r g b> <specular exponent> <refractive index>
+//   sphere <x y z> <radius> <material name or index>
+//   light <x y z> <intensity>
+//   plane <height> <x min> <x max> <z min> <z max> <r g b> <r g b>	checkerboard, a flat box with no material
+//   shape plane <x y z> <normal x y z> <material> [<texture>]			see Shape
+//   shape box <min x y z> <max x y z> <material> [<texture>]
+//   shape disc <x y z> <normal x y z> <radius> <material> [<texture>]
+//   mesh <.obj or .ply file> <material name or index> [<x y z> [<scale>]]	TriangleMesh, scaled then moved
+//   instance <mesh index> <material name or index> <x y z> [<scale> [<degrees about y>]]	another copy, see MeshInstance
+//   camera <x y z> <vertical fov in degrees>
+//   envmap <image file>
+//   frames <count>							length of the animation, by default up to the last keyframe
+//   key camera <frame> <x y z>				camera position at a frame, see Track
+//   key sphere <index> <frame> <x y z>	centre of a sphere at a frame, spheres numbered from 0 in file order
+//   key instance <index> <frame> <x y z>	position of an instance at a frame
+// Materials are numbered in the order they appear and can be used by spheres, meshes, instances and shapes
+// anywhere in the file. A shape's material can also be "none" (shaded like the checkerboard), its texture is
+// "checker <r g b> <r g b> [<size>]".
+// Mesh files are loaded (see MeshFile.h) and get their BVH while the scene loads, relative names from the
+// working directory like the envmap. Each mesh record also places its mesh once: meshes and their instances
+// are numbered from 0 in file order, and the instance records are numbered on from the number of meshes.
+// An instance shares the mesh's triangles and BVH, only its transform is stored.
+// The text is cut into chunks at line ends that are parsed on the thread pool side by side.
+//
+// Binary (.rtscene): a SceneHeader followed by the material, sphere, light, keyframe, mesh, instance and shape
+// records as flat little endian arrays, the envmap name and the mesh file names. Meshes are referenced, not
+// stored. The file is memory mapped and the records are read in place.
+// save_scene() writes it from any loaded scene, with checkerboards as shapes, so a text scene only needs to be
+// parsed once.
+
+constexpr char scene_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+constexpr uint32_t scene_version = 1;
+
+struct SceneHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t frames;	// length of the animation
+	double fov;			// vertical, radians
+	float eye[3];
+	uint32_t material_count, sphere_count, light_count, key_count, mesh_count, instance_count, shape_count;
+	uint32_t envmap_length, mesh_names_length;
+};
+
+// Clears 'scene' and fills it from the file, picks the format by the extension. Errors are printed and
+// leave false, with the line for text files
+bool load_scene(const char* filename, ThreadPool& pool, Scene& scene);
+bool save_scene(const char* filename, const Scene& scene);
+
+// Decimal number with optional sign, fraction and exponent at p, no further than 'end'. Up to 19 significant
+// digits are kept, the scaling by an exact power of ten makes the result correctly rounded in double for the
+// usual inputs. Moves p past the number, false (p unchanged) when there is none. Shared by the text loaders
+bool parse_number(const char*& p, const char* end, double& out);
+
+#endif
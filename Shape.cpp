@@ -0,0 +1,127 @@
+// Shape.cpp : Intersection, normals and textures of the analytic primitives declared in Shape.h
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Shape.h"
+
+Vec3f Texture::at(const Vec3f& p, const Vec3f& N, const Vec3f& material_colour) const
+{
+    if (kind == Kind::Material)
+        return material_colour;
+    Vec3f q = (p + N * (0.5f * size)) * (1.f / size);
+    int parity = int(std::floor(q.x)) + int(std::floor(q.y)) + int(std::floor(q.z));
+    return parity & 1 ? colour_b : colour_a;
+}
+
+Shape Shape::plane(const Vec3f& point, const Vec3f& normal, uint32_t material, const Texture& texture)
+{
+    Shape s;
+    s.kind = Kind::Plane;
+    s.a = point;
+    s.b = Vec3f(normal).normalize();
+    s.material = material;
+    s.texture = texture;
+    return s;
+}
+
+Shape Shape::box(const Vec3f& lo, const Vec3f& hi, uint32_t material, const Texture& texture)
+{
+    Shape s;
+    s.kind = Kind::Box;
+    s.a = Vec3f(std::fmin(lo.x, hi.x), std::fmin(lo.y, hi.y), std::fmin(lo.z, hi.z));
+    s.b = Vec3f(std::fmax(lo.x, hi.x), std::fmax(lo.y, hi.y), std::fmax(lo.z, hi.z));
+    s.material = material;
+    s.texture = texture;
+    return s;
+}
+
+Shape Shape::disc(const Vec3f& centre, const Vec3f& normal, float radius, uint32_t material, const Texture& texture)
+{
+    Shape s = plane(centre, normal, material, texture);
+    s.kind = Kind::Disc;
+    s.radius = radius;
+    return s;
+}
+
+AABB Shape::bounds() const
+{
+    switch (kind)
+    {
+    case Kind::Box:
+        return AABB(a, b);
+    case Kind::Disc:
+    {
+        // Extent along each axis is radius * sin of the angle between the axis and the normal
+        Vec3f e(radius * std::sqrt(std::fmax(0.f, 1.f - b.x * b.x)), radius * std::sqrt(std::fmax(0.f, 1.f - b.y * b.y)),
+            radius * std::sqrt(std::fmax(0.f, 1.f - b.z * b.z)));
+        return AABB(a - e, a + e);
+    }
+    default:
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        return AABB(Vec3f(-inf, -inf, -inf), Vec3f(inf, inf, inf));
+    }
+    }
+}
+
+bool Shape::intersect(const Vec3f& orig, const Vec3f& dir, float& t) const
+{
+    if (kind == Kind::Box)
+    {
+        float t_near = 0.f, t_far = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float o = orig[axis], d = dir[axis];
+            if (d == 0.f)
+            {
+                if (o < a[axis] || o > b[axis]) return false;
+                continue;
+            }
+            float t0 = (a[axis] - o) / d, t1 = (b[axis] - o) / d;
+            if (t0 > t1) std::swap(t0, t1);
+            t_near = std::fmax(t_near, t0);
+            t_far = std::fmin(t_far, t1);
+            if (t_near > t_far) return false;
+        }
+        t = t_near > 0.f ? t_near : t_far;
+        return t > 0.f;
+    }
+
+    float denom = b * dir;
+    if (denom == 0.f) return false;
+    t = (b * (a - orig)) / denom;
+    if (t <= 0.f) return false;
+    if (kind == Kind::Disc)
+    {
+        Vec3f offset = orig + dir * t - a;
+        return offset * offset <= radius * radius;
+    }
+    return true;
+}
+
+Vec3f Shape::normal(const Vec3f& p) const
+{
+    if (kind != Kind::Box)
+        return b;
+    Vec3f N(0.f, 1.f, 0.f);
+    float best = std::numeric_limits<float>::max();
+    for (int axis : { 1, 0, 2 })
+    {
+        float to_hi = std::fabs(p[axis] - b[axis]), to_lo = std::fabs(p[axis] - a[axis]);
+        if (to_hi < best)
+        {
+            best = to_hi;
+            N = Vec3f(0.f, 0.f, 0.f);
+            N[axis] = 1.f;
+        }
+        if (to_lo < best)
+        {
+            best = to_lo;
+            N = Vec3f(0.f, 0.f, 0.f);
+            N[axis] = -1.f;
+        }
+    }
+    return N;
+}
@@ -0,0 +1,60 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <cstdint>
+#include "Geometry.h"
+#include "BVH.h"
+
+// Procedural colour of a surface, evaluated once for the hit that is shaded and never for shadow rays
+struct Texture
+{
+	enum class Kind : uint32_t { Material, Checker };
+	Kind kind = Kind::Material;		// Material: the material's own diffuse colour
+	Vec3f colour_a{}, colour_b{};
+	float size = 1.f;				// edge of a checker cube
+
+	static Texture checker(const Vec3f& a, const Vec3f& b, float size = 1.f)
+	{
+		Texture t;
+		t.kind = Kind::Checker;
+		t.colour_a = a;
+		t.colour_b = b;
+		t.size = size;
+		return t;
+	}
+
+	// Checker: cubes of 'size' alternating between the colours through all of space. The point is moved half a
+	// cube along the normal first, so an axis aligned face never sits on a cube boundary and shows clean squares
+	Vec3f at(const Vec3f& p, const Vec3f& N, const Vec3f& material_colour) const;
+};
+
+// Analytic primitive next to the spheres and the mesh instances:
+//   Plane : infinite, through 'a' with unit normal 'b'
+//   Box   : axis aligned from 'a' (min corner) to 'b' (max corner), may be flat in one axis like a board
+//   Disc  : centre 'a', unit normal 'b', 'radius'
+// Boxes and discs go into the Scene's shape BVH, planes have no bounds and are tested on their own.
+// Planes and discs are hit from either side and keep the one normal, like a box face.
+struct Shape
+{
+	enum class Kind : uint32_t { Plane, Box, Disc };
+	Kind kind = Kind::Plane;
+	Vec3f a{}, b{};
+	float radius{};
+	uint32_t material{};	// index into Scene::materials, or Scene::no_material
+	Texture texture;
+
+	static Shape plane(const Vec3f& point, const Vec3f& normal, uint32_t material, const Texture& texture = Texture());
+	static Shape box(const Vec3f& lo, const Vec3f& hi, uint32_t material, const Texture& texture = Texture());
+	static Shape disc(const Vec3f& centre, const Vec3f& normal, float radius, uint32_t material, const Texture& texture = Texture());
+
+	bool bounded() const { return kind != Kind::Plane; }
+	AABB bounds() const;
+
+	// Nearest hit in front of the origin, for boxes the far side when the origin is inside
+	bool intersect(const Vec3f& orig, const Vec3f& dir, float& t) const;
+
+	// Unit normal at a point intersect found. A box takes the face the point is nearest to, +y over -y for a flat one
+	Vec3f normal(const Vec3f& p) const;
+};
+
+#endif
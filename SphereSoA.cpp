@@ -0,0 +1,42 @@
+// SphereSoA.cpp : Lays the scene spheres out as structure of arrays for the batched intersection in SphereSoA.h
+//
+
+#include "RayTracer.h"
+#include "SphereSoA.h"
+
+void SphereSoA::build(const std::vector<std::unique_ptr<Sphere>>& spheres, const std::vector<uint32_t>& order)
+{
+    count = order.size();
+    size_t padded = count + lane_width - 1;
+
+    // Dead padding spheres sit far behind the camera with zero radius, they can never be hit
+    cx.assign(padded, std::numeric_limits<float>::max());
+    cy.assign(padded, std::numeric_limits<float>::max());
+    cz.assign(padded, std::numeric_limits<float>::max());
+    radius.assign(padded, 0.f);
+    mat_id.assign(count, 0);
+    sphere_id.assign(count, 0);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Sphere& s = *spheres[order[i]];
+        cx[i] = s.centre.x;
+        cy[i] = s.centre.y;
+        cz[i] = s.centre.z;
+        radius[i] = s.radius;
+        sphere_id[i] = order[i];
+        mat_id[i] = s.material;
+    }
+}
+
+void SphereSoA::refit(const std::vector<std::unique_ptr<Sphere>>& spheres)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Sphere& s = *spheres[sphere_id[i]];
+        cx[i] = s.centre.x;
+        cy[i] = s.centre.y;
+        cz[i] = s.centre.z;
+        radius[i] = s.radius;
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef SPHERESOA_H
+#define SPHERESOA_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include "Geometry.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RT_SPHERE_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RT_SPHERE_SSE 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class Sphere;
+
+// Spheres laid out as structure of arrays so one SIMD instruction tests a whole batch against a ray.
+// The order follows the BVH leaves, so a leaf range [first, first+count) is a contiguous run here.
+// Every array is padded by 'lane_width - 1' dead spheres, a batch load may read past the last real one.
+class SphereSoA
+{
+public:
+#if defined(RT_SPHERE_AVX)
+	static constexpr int lane_width = 8;
+#elif defined(RT_SPHERE_SSE)
+	static constexpr int lane_width = 4;
+#else
+	static constexpr int lane_width = 1;
+#endif
+
+	std::vector<float> cx, cy, cz, radius;
+	std::vector<uint32_t> mat_id;			// index into Scene::materials
+	std::vector<uint32_t> sphere_id;		// index into the spheres the SoA was built from
+
+	size_t size() const { return count; }
+
+	// 'order' is the permutation to lay the spheres out in, normally BVH::prim_indices
+	void build(const std::vector<std::unique_ptr<Sphere>>& spheres, const std::vector<uint32_t>& order);
+
+	// Copies centres and radii of moved spheres in again, the order stays as built
+	void refit(const std::vector<std::unique_ptr<Sphere>>& spheres);
+
+	Vec3f centre(uint32_t i) const { return Vec3f(cx[i], cy[i], cz[i]); }
+
+	// Closest hit among spheres [first, first+n) that is nearer than t_max. Same maths as Sphere::ray_intersect,
+	// on a hit t_max is shrunk and the SoA index returned, otherwise -1
+	int closest_hit(uint32_t first, uint32_t n, const Vec3f& orig, const Vec3f& dir, float& t_max) const
+	{
+		int hit = -1;
+		alignas(32) float ts[lane_width];
+		for (uint32_t base = 0; base < n; base += lane_width)
+		{
+			uint32_t i = first + base;
+			for (int mask = hit_mask(i, n - base, orig, dir, t_max, ts); mask; mask &= mask - 1)
+			{
+				int lane = ctz(mask);
+				if (ts[lane] < t_max)
+				{
+					t_max = ts[lane];
+					hit = int(i + lane);
+				}
+			}
+		}
+		return hit;
+	}
+
+	// Any sphere of [first, first+n) hit nearer than t_max? Stops at the first batch with a hit
+	bool any_hit(uint32_t first, uint32_t n, const Vec3f& orig, const Vec3f& dir, float t_max) const
+	{
+		alignas(32) float ts[lane_width];
+		for (uint32_t base = 0; base < n; base += lane_width)
+		{
+			if (hit_mask(first + base, n - base, orig, dir, t_max, ts))
+				return true;
+		}
+		return false;
+	}
+
+private:
+	size_t count{};
+
+	// Tests the batch of 'lane_width' spheres starting at i, only the first 'lanes' of them count.
+	// Returns a bit per lane hit in [0, t_max), and the hit distances in ts
+	int hit_mask(uint32_t i, uint32_t lanes, const Vec3f& orig, const Vec3f& dir, float t_max, float* ts) const
+	{
+		int mask = 0;
+#if defined(RT_SPHERE_AVX)
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 vx = _mm256_sub_ps(_mm256_loadu_ps(&cx[i]), _mm256_set1_ps(orig.x));
+		__m256 vy = _mm256_sub_ps(_mm256_loadu_ps(&cy[i]), _mm256_set1_ps(orig.y));
+		__m256 vz = _mm256_sub_ps(_mm256_loadu_ps(&cz[i]), _mm256_set1_ps(orig.z));
+		__m256 r = _mm256_loadu_ps(&radius[i]);
+
+		__m256 c_proj = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, _mm256_set1_ps(dir.x)), _mm256_mul_ps(vy, _mm256_set1_ps(dir.y))),
+			_mm256_mul_ps(vz, _mm256_set1_ps(dir.z)));
+		__m256 vv = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+		__m256 d = _mm256_sub_ps(vv, _mm256_mul_ps(c_proj, c_proj));
+		__m256 h2 = _mm256_sub_ps(_mm256_mul_ps(r, r), d);
+		__m256 dist = _mm256_sqrt_ps(_mm256_max_ps(h2, zero));
+		__m256 t_near = _mm256_sub_ps(c_proj, dist);
+		__m256 t = _mm256_blendv_ps(t_near, _mm256_add_ps(c_proj, dist), _mm256_cmp_ps(t_near, zero, _CMP_LT_OQ));
+
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(h2, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+		mask = _mm256_movemask_ps(valid);
+		_mm256_store_ps(ts, t);
+#elif defined(RT_SPHERE_SSE)
+		const __m128 zero = _mm_setzero_ps();
+		__m128 vx = _mm_sub_ps(_mm_loadu_ps(&cx[i]), _mm_set1_ps(orig.x));
+		__m128 vy = _mm_sub_ps(_mm_loadu_ps(&cy[i]), _mm_set1_ps(orig.y));
+		__m128 vz = _mm_sub_ps(_mm_loadu_ps(&cz[i]), _mm_set1_ps(orig.z));
+		__m128 r = _mm_loadu_ps(&radius[i]);
+
+		__m128 c_proj = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(dir.x)), _mm_mul_ps(vy, _mm_set1_ps(dir.y))),
+			_mm_mul_ps(vz, _mm_set1_ps(dir.z)));
+		__m128 vv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		__m128 d = _mm_sub_ps(vv, _mm_mul_ps(c_proj, c_proj));
+		__m128 h2 = _mm_sub_ps(_mm_mul_ps(r, r), d);
+		__m128 dist = _mm_sqrt_ps(_mm_max_ps(h2, zero));
+		__m128 t_near = _mm_sub_ps(c_proj, dist);
+		__m128 use_far = _mm_cmplt_ps(t_near, zero);	// no blendv before SSE4.1
+		__m128 t = _mm_or_ps(_mm_and_ps(use_far, _mm_add_ps(c_proj, dist)), _mm_andnot_ps(use_far, t_near));
+
+		__m128 valid = _mm_and_ps(_mm_cmpge_ps(h2, zero), _mm_cmpge_ps(t, zero));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(t_max)));
+		mask = _mm_movemask_ps(valid);
+		_mm_store_ps(ts, t);
+#else
+		float vx = cx[i] - orig.x, vy = cy[i] - orig.y, vz = cz[i] - orig.z;
+		float c_proj = vx * dir.x + vy * dir.y + vz * dir.z;
+		float d = vx * vx + vy * vy + vz * vz - c_proj * c_proj;
+		float h2 = radius[i] * radius[i] - d;
+		if (h2 < 0) return 0;
+		float dist = std::sqrt(h2);
+		float t = c_proj - dist;
+		if (t < 0) t = c_proj + dist;
+		ts[0] = t;
+		mask = t >= 0 && t < t_max;
+#endif
+		if (lanes < uint32_t(lane_width)) mask &= (1 << lanes) - 1;
+		return mask;
+	}
+
+	static int ctz(int mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward(&idx, unsigned(mask));
+		return int(idx);
+#else
+		return __builtin_ctz(unsigned(mask));
+#endif
+	}
+};
+
+#endif
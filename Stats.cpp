@@ -0,0 +1,111 @@
+// Stats.cpp : Registry and report of the RT_STATS counters declared in Stats.h
+//
+
+#include "Stats.h"
+
+#if defined(RT_STATS)
+
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+    // Owned here rather than by the threads, so a thread that ends doesn't take its counts along
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<RayStats>> registry;
+
+    double percent(uint64_t part, uint64_t whole) { return whole ? 100. * part / whole : 0.; }
+}
+
+void RayStats::add(const RayStats& other)
+{
+    for (int k = 0; k < int(RayKind::Count); ++k)
+        for (int d = 0; d < depths; ++d)
+            generated[k][d] += other.generated[k][d];
+    for (int d = 0; d < depths; ++d)
+    {
+        traced[d] += other.traced[d];
+        hits[d] += other.hits[d];
+    }
+    shadow_rays += other.shadow_rays;
+    shadow_blocked += other.shadow_blocked;
+    envmap_lookups += other.envmap_lookups;
+    for (int s = 0; s < int(Stage::Count); ++s)
+    {
+        stage_calls[s] += other.stage_calls[s];
+        stage_ns[s] += other.stage_ns[s];
+    }
+}
+
+RayStats& register_stats_thread()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(std::make_unique<RayStats>());
+    return *registry.back();
+}
+
+RayStats gather_stats()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    RayStats sum;
+    for (const auto& s : registry)
+        sum.add(*s);
+    return sum;
+}
+
+void reset_stats()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto& s : registry)
+        *s = RayStats();
+}
+
+void report_stats(const RayStats& stats, const std::vector<TileStats>& tiles)
+{
+    std::streamsize precision = std::cout.precision();
+    std::cout << "Rays by depth:\n"
+        << "  depth     primary  reflection  refraction      traced   hit %\n";
+    uint64_t total = 0;
+    for (int d = 0; d < RayStats::depths; ++d)
+    {
+        uint64_t generated = 0;
+        for (int k = 0; k < int(RayKind::Count); ++k)
+            generated += stats.generated[k][d];
+        if (!generated) continue;
+        total += generated;
+        std::cout << "  " << std::setw(5) << d;
+        for (int k = 0; k < int(RayKind::Count); ++k)
+            std::cout << std::setw(12) << stats.generated[k][d];
+        std::cout << std::setw(12) << stats.traced[d] << std::fixed << std::setprecision(1)
+            << std::setw(8) << percent(stats.hits[d], stats.traced[d]) << std::defaultfloat << "\n";
+    }
+    std::cout << "  " << total << " camera and secondary rays, " << stats.shadow_rays << " shadow rays ("
+        << std::fixed << std::setprecision(1) << percent(stats.shadow_blocked, stats.shadow_rays) << "% blocked), "
+        << stats.envmap_lookups << " envmap lookups\n";
+
+    // The tile times are wall time per tile, the same thread time the stage timers add up
+    double tile_ms = 0;
+    for (const TileStats& t : tiles)
+        tile_ms += t.ms;
+    const char* names[] = { "closest hit", "shadow", "background" };
+    double staged_ms = 0;
+    std::cout << "Stage time of " << std::setprecision(1) << tile_ms << " ms in tiles:\n";
+    for (int s = 0; s < int(Stage::Count); ++s)
+    {
+        double ms = stats.stage_ns[s] * 1e-6;
+        staged_ms += ms;
+        std::cout << "  " << std::left << std::setw(12) << names[s] << std::right << std::setw(10) << ms << " ms "
+            << std::setw(5) << percent(uint64_t(ms * 1e3), uint64_t(tile_ms * 1e3)) << "%  "
+            << std::setprecision(2) << std::setw(8) << (stats.stage_calls[s] ? stats.stage_ns[s] / double(stats.stage_calls[s]) : 0.)
+            << " ns/call over " << stats.stage_calls[s] << " calls\n" << std::setprecision(1);
+    }
+    double rest_ms = std::max(0., tile_ms - staged_ms);
+    std::cout << "  " << std::left << std::setw(12) << "shading" << std::right << std::setw(10) << rest_ms << " ms "
+        << std::setw(5) << percent(uint64_t(rest_ms * 1e3), uint64_t(tile_ms * 1e3)) << "%  (ray generation, shading, the rest)\n"
+        << std::defaultfloat << std::setprecision(precision);
+    std::cout.flush();
+}
+
+#endif
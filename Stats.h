@@ -0,0 +1,108 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Hot path counters, compiled in when RT_STATS is defined (-DRT_STATS, /D RT_STATS) and gone otherwise:
+// every RT_STAT_* macro below is then an empty statement that doesn't evaluate its arguments.
+// Each thread counts into its own RayStats, render() adds them up after the frame and prints
+//   rays per depth : primary, reflection and refraction rays generated, how many of them were traced
+//                    (not past max_depth) and how many of those hit something
+//   shadow rays    : traced and blocked
+//   envmap         : lookups in background_color, the rays that left the scene or the depth limit
+//   stage time     : thread time in closest hit queries, shadow queries and background lookups. The rest of
+//                    the tile time is ray generation and shading.
+// The timers read the clock twice per query, which makes the cheap stages look slower than they are.
+
+#if defined(RT_STATS)
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "RayTracer.h"
+
+enum class RayKind { Primary, Reflection, Refraction, Count };
+enum class Stage { Intersect, Shadow, Background, Count };
+
+struct RayStats
+{
+	static constexpr int depths = max_depth + 2;	// the last depth is only generated, never traced
+
+	uint64_t generated[int(RayKind::Count)][depths]{};
+	uint64_t traced[depths]{}, hits[depths]{};
+	uint64_t shadow_rays{}, shadow_blocked{};
+	uint64_t envmap_lookups{};
+	uint64_t stage_calls[int(Stage::Count)]{};
+	uint64_t stage_ns[int(Stage::Count)]{};
+
+	void add(const RayStats& other);
+};
+
+// Counters of the calling thread, registered on first use and kept until the program ends
+RayStats& register_stats_thread();
+inline RayStats& thread_stats()
+{
+	thread_local RayStats& stats = register_stats_thread();
+	return stats;
+}
+
+// Sum over / reset of every registered thread, only while none of them is counting
+RayStats gather_stats();
+void reset_stats();
+void report_stats(const RayStats& stats, const std::vector<TileStats>& tiles);
+
+inline void count_rays(RayKind kind, int depth, uint64_t n)
+{
+	thread_stats().generated[int(kind)][std::min(depth, RayStats::depths - 1)] += n;
+}
+
+inline void count_hits(int depth, uint64_t traced, uint64_t hits)
+{
+	RayStats& s = thread_stats();
+	depth = std::min(depth, RayStats::depths - 1);
+	s.traced[depth] += traced;
+	s.hits[depth] += hits;
+}
+
+// Adds the time from construction to destruction to a stage
+class StageTimer
+{
+public:
+	explicit StageTimer(Stage s) : stage{ s }, start{ std::chrono::steady_clock::now() } {}
+	~StageTimer()
+	{
+		RayStats& s = thread_stats();
+		s.stage_ns[int(stage)] += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		++s.stage_calls[int(stage)];
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+	Stage stage;
+	std::chrono::steady_clock::time_point start;
+};
+
+#define RT_STAT_RAYS(kind, depth, n) count_rays(RayKind::kind, (depth), (n))
+#define RT_STAT_HITS(depth, traced, hits) count_hits((depth), (traced), (hits))
+#define RT_STAT_SHADOW(blocked) (++thread_stats().shadow_rays, thread_stats().shadow_blocked += (blocked) ? 1 : 0)
+#define RT_STAT_ENVMAP() (++thread_stats().envmap_lookups)
+#define RT_STAT_TIME(stage) StageTimer rt_stage_timer{ Stage::stage }
+#define RT_STAT_RESET() reset_stats()
+#define RT_STAT_REPORT(tiles) report_stats(gather_stats(), (tiles))
+
+#else
+
+// The arguments only go into sizeof, which never evaluates them (no std::count over the hit flags) but
+// still counts as a use of variables that exist for the counters alone
+#define RT_STAT_RAYS(kind, depth, n) ((void)sizeof(depth), (void)sizeof(n))
+#define RT_STAT_HITS(depth, traced, hits) ((void)sizeof(depth), (void)sizeof(traced), (void)sizeof(hits))
+#define RT_STAT_SHADOW(blocked) ((void)sizeof(blocked))
+#define RT_STAT_ENVMAP() ((void)0)
+#define RT_STAT_TIME(stage) ((void)0)
+#define RT_STAT_RESET() ((void)0)
+#define RT_STAT_REPORT(tiles) ((void)0)
+
+#endif
+
+#endif
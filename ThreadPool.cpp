@@ -0,0 +1,116 @@
+// ThreadPool.cpp : Work stealing pool declared in ThreadPool.h
+//
+
+#include <algorithm>
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < threads; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    for (unsigned i = 1; i < threads; ++i)
+        this->threads.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        quit = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t, unsigned)>& fn)
+{
+    if (count == 0) return;
+
+    size_t n = workers.size();
+    for (size_t w = 0; w < n; ++w)
+    {
+        std::lock_guard<std::mutex> lock(workers[w]->m);
+        workers[w]->steals = 0;
+        for (size_t task = w * count / n; task < (w + 1) * count / n; ++task)
+            workers[w]->tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m);
+        job = &fn;
+        remaining = count;
+        running = unsigned(threads.size());
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    // Every task is finished, but wait until the workers have let go of 'fn' as well
+    std::unique_lock<std::mutex> lock(m);
+    done.wait(lock, [this] { return running == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::worker_loop(unsigned index)
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+        }
+
+        drain(index);
+
+        std::lock_guard<std::mutex> lock(m);
+        if (--running == 0)
+            done.notify_one();
+    }
+}
+
+void ThreadPool::drain(unsigned index)
+{
+    size_t task;
+    while (remaining.load() > 0 && pop(index, task))
+    {
+        (*job)(task, index);
+        --remaining;
+    }
+}
+
+// Own queue first (front), then steal from the back of the others, starting with the next worker
+bool ThreadPool::pop(unsigned index, size_t& task)
+{
+    {
+        Worker& own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.m);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t k = 1; k < workers.size(); ++k)
+    {
+        Worker& victim = *workers[(index + k) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.m);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            ++workers[index]->steals;
+            return true;
+        }
+    }
+    return false;
+}
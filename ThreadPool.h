@@ -0,0 +1,59 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Persistent pool of workers with one task queue each. A worker drains its own queue from the front and,
+// once empty, steals from the back of the others, so a few expensive tasks can't leave cores idle.
+// The thread calling parallel_for works as worker 0, a pool of size n runs n - 1 extra threads.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned threads = 0);	// 0 : one worker per hardware thread
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned size() const { return unsigned(workers.size()); }
+
+	// Runs fn(task, worker) for every task in [0, count) and returns when all of them are done.
+	// Tasks are dealt out to the queues in contiguous blocks, neighbouring tasks start on the same worker
+	void parallel_for(size_t count, const std::function<void(size_t, unsigned)>& fn);
+
+	// Tasks each worker took from another queue during the last parallel_for
+	uint64_t steals(unsigned worker) const { return workers[worker]->steals; }
+
+private:
+	struct Worker
+	{
+		std::mutex m;
+		std::deque<size_t> tasks;
+		uint64_t steals{};
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	std::mutex m;
+	std::condition_variable wake, done;
+	const std::function<void(size_t, unsigned)>* job{};
+	uint64_t generation{};
+	unsigned running{};
+	std::atomic<size_t> remaining{};
+	bool quit{};
+
+	void worker_loop(unsigned index);
+	void drain(unsigned index);
+	bool pop(unsigned index, size_t& task);
+};
+
+#endif
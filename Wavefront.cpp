@@ -0,0 +1,131 @@
+// Wavefront.cpp : Generation by generation tile renderer declared in Wavefront.h
+//
+
+#include <algorithm>
+#include "RayTracer.h"
+#include "Wavefront.h"
+#include "Stats.h"
+
+void Wavefront::trace_tile(const Scene& scene, int x0, int y0, int x1, int y1, int first, int count, Framebuffer& frame)
+{
+    int w = x1 - x0;
+    accum.assign(size_t(w) * (y1 - y0), Vec3f(0.f, 0.f, 0.f));
+
+    for (int depth = 0; !rays.empty(); ++depth)
+    {
+        intersect(scene, depth);
+        shade(scene);
+        spawn(scene, depth);
+        rays.swap(next);
+    }
+
+    for (int j = y0; j < y1; ++j)
+        for (int i = x0; i < x1; ++i)
+            frame.add_samples(i, j, accum[(j - y0) * w + (i - x0)], first, count);
+}
+
+void Wavefront::intersect(const Scene& scene, int depth)
+{
+    size_t n = rays.size();
+    // Fresh records every generation, resolve_hit leaves them alone for a miss
+    material_ids.assign(n, Scene::no_material);
+    diffuse_colors.assign(n, Vec3f());
+    hit_pts.assign(n, Vec3f());
+    normals.assign(n, Vec3f());
+    is_hit.assign(n, 0);
+    if (depth == 0)
+        RT_STAT_RAYS(Primary, 0, n);
+
+    // Past the depth limit every ray just takes the background, like cast_ray does
+    if (depth > max_depth)
+        return;
+    rays_traced += n;
+
+    if (depth == 0 && use_packets)
+    {
+        RayPacket packet;
+        for (size_t base = 0; base < n; base += RayPacket::size)
+        {
+            packet.active = 0;
+            for (int r = 0; r < RayPacket::size; ++r)
+            {
+                if (base + r < n)
+                {
+                    packet.set(r, rays[base + r].orig, rays[base + r].dir);
+                }
+                else
+                {
+                    packet.set(r, Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 0.f, -1.f));
+                    packet.active &= ~(1u << r);
+                }
+            }
+            packet_closest_hit(packet, scene);
+
+            for (int r = 0; r < RayPacket::size && base + r < n; ++r)
+            {
+                size_t k = base + r;
+                is_hit[k] = resolve_hit(rays[k].orig, rays[k].dir, scene, packet.sphere[r], packet.t[r], material_ids[k], diffuse_colors[k], hit_pts[k], normals[k]);
+            }
+        }
+    }
+    else
+    {
+        for (size_t k = 0; k < n; ++k)
+            is_hit[k] = pixel_depth_check(rays[k].orig, rays[k].dir, scene, material_ids[k], diffuse_colors[k], hit_pts[k], normals[k]);
+    }
+    RT_STAT_HITS(depth, n, uint64_t(std::count(is_hit.begin(), is_hit.end(), uint8_t(1))));
+}
+
+void Wavefront::shade(const Scene& scene)
+{
+    for (size_t k = 0; k < rays.size(); ++k)
+    {
+        const WavefrontRay& ray = rays[k];
+        Vec3f color = is_hit[k] ? direct_light(ray.dir, scene, scene.surface(material_ids[k], diffuse_colors[k]), hit_pts[k], normals[k])
+            : background_color(ray.orig, ray.dir);
+        accum[ray.pixel] = accum[ray.pixel] + color * ray.weight;
+    }
+}
+
+void Wavefront::spawn(const Scene& scene, int depth)
+{
+    next.clear();
+    for (size_t k = 0; k < rays.size(); ++k)
+    {
+        if (!is_hit[k]) continue;
+        const WavefrontRay& ray = rays[k];
+        const Material& m = scene.material(material_ids[k]);
+
+        WavefrontRay reflected{ Vec3f(), Vec3f(), ray.weight * m.albedo[2], ray.pixel };
+        reflection_ray(ray.dir, normals[k], hit_pts[k], reflected.orig, reflected.dir);
+        float reflected_scale = secondary_scale(reflected.weight, reflected.orig, reflected.dir);
+        if (reflected_scale > 0)
+        {
+            reflected.weight *= reflected_scale;
+            next.push_back(reflected);
+            RT_STAT_RAYS(Reflection, depth + 1, 1);
+        }
+
+        WavefrontRay refracted{ Vec3f(), Vec3f(), ray.weight * m.albedo[3], ray.pixel };
+        refraction_ray(ray.dir, normals[k], hit_pts[k], m.refractive_index, refracted.orig, refracted.dir);
+        float refracted_scale = secondary_scale(refracted.weight, refracted.orig, refracted.dir);
+        if (refracted_scale > 0)
+        {
+            refracted.weight *= refracted_scale;
+            next.push_back(refracted);
+            RT_STAT_RAYS(Refraction, depth + 1, 1);
+        }
+    }
+
+    // Group by direction octant (counting sort, stable) so rays that follow each other traverse the same nodes
+    auto octant = [](const WavefrontRay& r) { return (r.dir.x < 0) | ((r.dir.y < 0) << 1) | ((r.dir.z < 0) << 2); };
+    size_t start[9] = {};
+    for (const WavefrontRay& r : next)
+        ++start[octant(r) + 1];
+    for (int o = 0; o < 8; ++o)
+        start[o + 1] += start[o];
+    rays.resize(next.size());
+    for (const WavefrontRay& r : next)
+        rays[start[octant(r)]++] = r;
+    next.swap(rays);
+}
@@ -0,0 +1,78 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include <cstdint>
+#include "Geometry.h"
+#include "Packet.h"
+
+struct Scene;
+class Framebuffer;
+
+// A ray waiting in a generation, 'weight' is the factor its colour contributes to the pixel with
+struct WavefrontRay
+{
+	Vec3f orig{}, dir{};
+	float weight{};
+	uint32_t pixel{};	// index into the tile
+};
+
+// Iterative replacement for the recursion in cast_ray. Each bounce generation of a tile is a flat array
+// of rays that goes through three bulk stages:
+//   intersect : closest hit for every ray (4x4 packets for the primary generation)
+//   shade     : misses add the background, hits add their direct light, both scaled by the ray weight
+//   spawn     : reflection and refraction rays of every hit, weighted by albedo[2] and albedo[3], form the
+//               next generation, grouped by direction octant so neighbouring rays traverse alike.
+//               Rays that contribute too little are dropped or played in a roulette, see Termination
+// The colour is the same sum the recursion builds, only added up in another order.
+// One instance per worker, the arrays are kept between tiles.
+class Wavefront
+{
+public:
+	// Cam is Camera or one of the FixedCamera sizes. Traces samples first .. first + count - 1 of every pixel,
+	// each a primary ray of weight 1, and folds them into the frame with Framebuffer::add_samples, so the ray
+	// termination doesn't depend on the sample count
+	template <class Cam>
+	void render_tile(const Scene& scene, const Cam& camera, int x0, int y0, int x1, int y1, int first, int count, Framebuffer& frame)
+	{
+		// Primary generation in 4x4 block order, the samples of a block one after the other,
+		// so every 16 consecutive rays form a coherent packet
+		rays.clear();
+		int w = x1 - x0;
+		for (int by = y0; by < y1; by += RayPacket::height)
+		{
+			for (int bx = x0; bx < x1; bx += RayPacket::width)
+			{
+				for (int s = first; s < first + count; ++s)
+				{
+					for (int r = 0; r < RayPacket::size; ++r)
+					{
+						int i = bx + r % RayPacket::width, j = by + r / RayPacket::width;
+						if (i < x1 && j < y1)
+							rays.push_back(WavefrontRay{ camera.origin(), camera.dir(i, j, s), 1.f, uint32_t((j - y0) * w + (i - x0)) });
+					}
+				}
+			}
+		}
+		trace_tile(scene, x0, y0, x1, y1, first, count, frame);
+	}
+
+	uint64_t rays_traced{};	// over every tile rendered by this instance
+
+private:
+	std::vector<WavefrontRay> rays, next;
+	// Hit records of the current generation, parallel to 'rays'
+	std::vector<uint32_t> material_ids;	// Scene::materials, the Material is only fetched to shade
+	std::vector<Vec3f> diffuse_colors;
+	std::vector<Vec3f> hit_pts, normals;
+	std::vector<uint8_t> is_hit;
+	std::vector<Vec3f> accum;	// colour per pixel of the tile
+
+	// Runs the generations of the primary rays in 'rays', 'count' per pixel, and adds them to the tile
+	void trace_tile(const Scene& scene, int x0, int y0, int x1, int y1, int first, int count, Framebuffer& frame);
+	void intersect(const Scene& scene, int depth);
+	void shade(const Scene& scene);
+	void spawn(const Scene& scene, int depth);	// depth of the generation in 'rays'
+};
+
+#endif